@@ -0,0 +1,269 @@
+/*
+	Benchmarks for extendible_hashing.hpp and concurrent_extendible_hashing.hpp.
+    Author: Ameya Daigavane
+*/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <cassert>
+#include "extendible_hashing.hpp"
+#include "concurrent_extendible_hashing.hpp"
+
+/* Small xorshift generator, one per thread. */
+struct XorShift {
+    uint64_t state;
+
+    XorShift(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    uint64_t next(){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+/* Run ops_per_thread operations on each of num_threads threads, and return the total throughput in Mops/s. */
+template <typename OP>
+double run_threads(int num_threads, int ops_per_thread, OP op){
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&op, t, ops_per_thread](){
+            XorShift rng(t + 1);
+            for(int i = 0; i < ops_per_thread; ++i){
+                op(rng);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return num_threads * (double) ops_per_thread / elapsed.count() / 1e6;
+}
+
+/* Mixed workload: 90% lookups, 10% inserts over a preloaded key range, from 1 to 64 threads. */
+void bench_concurrency(){
+    const int key_range = 1 << 20;
+    const int ops_per_thread = 200000;
+
+    std::cout << "Threads | global mutex (Mops/s) | concurrent (Mops/s)" << "\n";
+    for(int num_threads = 1; num_threads <= 64; num_threads *= 2){
+
+        ExtendibleHashTable<int, int> eht(0, 16);
+        ConcurrentExtendibleHashTable<int, int> ceht(0, 16);
+        for(int key = 0; key < key_range; key += 2){
+            eht.insert(key, key);
+            ceht.insert(key, key);
+        }
+
+        std::mutex global_mutex;
+        double locked = run_threads(num_threads, ops_per_thread, [&](XorShift& rng){
+            uint64_t r = rng.next();
+            int key = (int) (r % key_range);
+            std::lock_guard<std::mutex> guard(global_mutex);
+            if((r >> 32) % 10 == 0){
+                eht.insert(key, key);
+            } else {
+                eht.count(key);
+            }
+        });
+
+        double concurrent = run_threads(num_threads, ops_per_thread, [&](XorShift& rng){
+            uint64_t r = rng.next();
+            int key = (int) (r % key_range);
+            if((r >> 32) % 10 == 0){
+                ceht.insert(key, key);
+            } else {
+                ceht.count(key);
+            }
+        });
+
+        std::cout << num_threads << " | " << locked << " | " << concurrent << "\n";
+    }
+}
+
+/* Worst single-insert latency, with the directory copied all at once versus in chunks. */
+void bench_insert_latency(){
+    const int num_inserts = 1 << 22;
+    size_t chunks[] = {std::numeric_limits<size_t>::max(), 1024};
+
+    std::cout << "Migration chunk | total (s) | worst insert (us)" << "\n";
+    for(int c = 0; c < 2; ++c){
+        ExtendibleHashTable<int, int> eht(0, 4);
+        eht.set_migration_chunk(chunks[c]);
+
+        double worst = 0;
+        auto start = std::chrono::steady_clock::now();
+        XorShift rng(1);
+        for(int i = 0; i < num_inserts; ++i){
+            int key = (int) (rng.next() & 0x7fffffff);
+            auto before = std::chrono::steady_clock::now();
+            eht.insert(key, i);
+            std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - before;
+            if(took.count() > worst){
+                worst = took.count();
+            }
+        }
+        std::chrono::duration<double> total = std::chrono::steady_clock::now() - start;
+
+        std::cout << (c == 0 ? "all at once" : "1024") << " | " << total.count() << " | " << worst << "\n";
+    }
+}
+
+/* Lookups and inserts on a table much larger than the last-level cache, one at a time versus batched. */
+void bench_batches(){
+    const int num_keys = 1 << 23;
+
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> lookups;
+    XorShift rng(7);
+    for(int i = 0; i < num_keys; ++i){
+        int key = (int) (rng.next() & 0x7fffffff);
+        pairs.push_back(std::make_pair(key, i));
+        lookups.push_back(key);
+    }
+
+    ExtendibleHashTable<int, int> single(0, 16);
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < pairs.size(); ++i){
+        single.insert(pairs[i].first, pairs[i].second);
+    }
+    std::chrono::duration<double> single_insert = std::chrono::steady_clock::now() - start;
+
+    ExtendibleHashTable<int, int> batched(0, 16);
+    start = std::chrono::steady_clock::now();
+    batched.insert_batch(pairs.begin(), pairs.end());
+    std::chrono::duration<double> batch_insert = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for(size_t i = 0; i < lookups.size(); ++i){
+        hits += single.count(lookups[i]);
+    }
+    std::chrono::duration<double> single_find = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    std::vector<int*> found;
+    batched.find_batch(lookups, found);
+    std::chrono::duration<double> batch_find = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Operation | one at a time (Mops/s) | batched (Mops/s)" << "\n";
+    std::cout << "insert | " << num_keys / single_insert.count() / 1e6 << " | " << num_keys / batch_insert.count() / 1e6 << "\n";
+    std::cout << "find | " << num_keys / single_find.count() / 1e6 << " | " << num_keys / batch_find.count() / 1e6 << "\n";
+    assert(hits == lookups.size());
+}
+
+/* Directory growth and insert speed of one hasher, on keys generated by key(i). */
+template <typename Hasher, typename KEYGEN>
+void bench_hasher(const char* hasher_name, const char* keys_name, KEYGEN key){
+    const int num_keys = 1 << 16;
+
+    ExtendibleHashTable<long long, int, Hasher> eht(0, 16);
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < num_keys; ++i){
+        eht.insert(key(i), i);
+    }
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+    /* A perfect hash fills num_keys / 16 buckets, with a directory just as large. */
+    std::cout << keys_name << " | " << hasher_name << " | " << eht.get_global_depth() << " | " << eht.get_num_buckets()
+              << " | " << num_keys / took.count() / 1e6 << "\n";
+}
+
+/* Hash quality and speed of the identity hash against the default MixHash. */
+void bench_hashers(){
+    std::cout << "Keys | hasher | global depth | buckets | inserts (Mops/s)" << "\n";
+
+    auto sequential = [](int i){ return (long long) i; };
+    auto strided = [](int i){ return (long long) i << 12; };
+    auto random = [](int i){ return (long long) (mix64(i) >> 1); };
+
+    bench_hasher<IdentityHash<long long>>("identity", "sequential", sequential);
+    bench_hasher<MixHash<long long>>("mix", "sequential", sequential);
+    bench_hasher<IdentityHash<long long>>("identity", "4KB strided", strided);
+    bench_hasher<MixHash<long long>>("mix", "4KB strided", strided);
+    bench_hasher<IdentityHash<long long>>("identity", "random", random);
+    bench_hasher<MixHash<long long>>("mix", "random", random);
+
+    /* Raw hashing speed. */
+    const int num_inputs = 1 << 20;
+    const int rounds = 64;
+    std::vector<long long> inputs;
+    for(int i = 0; i < num_inputs; ++i){
+        inputs.push_back((long long) i << 12);
+    }
+    IdentityHash<long long> identity;
+    MixHash<long long> mix;
+    size_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r){
+        for(int i = 0; i < num_inputs; ++i){
+            sink ^= identity(inputs[i] + r);
+        }
+    }
+    std::chrono::duration<double> identity_took = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r){
+        for(int i = 0; i < num_inputs; ++i){
+            sink ^= mix(inputs[i] + r);
+        }
+    }
+    std::chrono::duration<double> mix_took = std::chrono::steady_clock::now() - start;
+
+    double num_hashes = (double) num_inputs * rounds;
+    std::cout << "Hashing (Mhashes/s): identity " << num_hashes / identity_took.count() / 1e6
+              << ", mix " << num_hashes / mix_took.count() / 1e6 << " (" << sink % 2 << ")" << "\n";
+}
+
+/* Full-table scan through the iterator, against summing a plain vector of the same pairs. */
+void bench_scan(){
+    const int num_keys = 1 << 23;
+
+    ExtendibleHashTable<long long, long long> eht(0, 16);
+    std::vector<std::pair<long long, long long>> plain;
+    XorShift rng(11);
+    for(int i = 0; i < num_keys; ++i){
+        long long key = (long long) rng.next();
+        eht.insert(key, i);
+        plain.push_back(std::make_pair(key, (long long) i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    long long table_sum = 0;
+    for(ExtendibleHashTable<long long, long long>::iterator it = eht.begin(); it != eht.end(); ++it){
+        table_sum += it.value();
+    }
+    std::chrono::duration<double> table_scan = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    long long plain_sum = 0;
+    for(size_t i = 0; i < plain.size(); ++i){
+        plain_sum += plain[i].second;
+    }
+    std::chrono::duration<double> plain_scan = std::chrono::steady_clock::now() - start;
+
+    /* Bytes of pairs visited per second; the table also reads its empty slots and sizes. */
+    double bytes = (double) num_keys * 2 * sizeof(long long);
+    std::cout << "Scan | table (GB/s) | vector (GB/s)" << "\n";
+    std::cout << "sum of values | " << bytes / table_scan.count() / 1e9 << " | " << bytes / plain_scan.count() / 1e9 << "\n";
+    assert(table_sum == plain_sum);
+}
+
+int main(){
+    bench_concurrency();
+    bench_insert_latency();
+    bench_batches();
+    bench_hashers();
+    bench_scan();
+}
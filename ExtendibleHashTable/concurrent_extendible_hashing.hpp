@@ -0,0 +1,370 @@
+/*
+    Concurrent Extendible Hashing in C++.
+    Author: Ameya Daigavane
+
+    A thread-safe variant of ExtendibleHashTable, for trivially copyable keys and values.
+    Readers normally take no lock: every bucket carries a version counter (a seqlock), which is odd while a
+    writer is modifying the bucket, and readers retry if the version changed under them. After a few
+    retries, a reader takes the bucket lock like a writer, so that writers cannot starve it.
+    Writers lock only the bucket they modify. Only doubling the directory excludes other writers, and
+    readers can keep using the old directory meanwhile.
+*/
+
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include "hashers.hpp"
+#include <type_traits>
+
+template <typename KEY, typename VAL>
+struct ConcurrentHashBucket {
+
+    /* Even when the bucket is stable, odd while a writer is modifying it. */
+    std::atomic<size_t> version;
+
+    /* Held by writers of this bucket. */
+    std::mutex lock;
+
+    /* Every key in this bucket has these local_depth low bits of hash. */
+    std::atomic<size_t> local_depth;
+    std::atomic<size_t> pattern;
+
+    std::atomic<size_t> num_keys;
+    std::unique_ptr<std::atomic<KEY>[]> keys;
+    std::unique_ptr<std::atomic<VAL>[]> vals;
+
+    ConcurrentHashBucket(size_t local_depth, size_t pattern, size_t max_slots)
+        : version(0), local_depth(local_depth), pattern(pattern), num_keys(0),
+          keys(new std::atomic<KEY>[max_slots]), vals(new std::atomic<VAL>[max_slots]) {}
+
+    /* True if the keys with this hash value belong in this bucket. */
+    bool covers(size_t hash_val){
+        size_t depth = local_depth.load(std::memory_order_relaxed);
+        return (hash_val & (((size_t) 1 << depth) - 1)) == pattern.load(std::memory_order_relaxed);
+    }
+
+    /* Returns the slot holding key, or num_keys if absent. Callers must validate the version afterwards. */
+    size_t find_slot(const KEY& key, size_t size){
+        for(size_t i = 0; i < size; ++i){
+            if(keys[i].load(std::memory_order_relaxed) == key){
+                return i;
+            }
+        }
+        return size;
+    }
+
+    /* Writers bracket their modifications with these, while holding the lock. */
+    void begin_write(){
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write(){
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+template <typename KEY, typename VAL, typename Hasher = MixHash<KEY>>
+class ConcurrentExtendibleHashTable {
+
+    static_assert(std::is_trivially_copyable<KEY>::value && std::is_trivially_copyable<VAL>::value,
+                  "ConcurrentExtendibleHashTable needs trivially copyable keys and values.");
+
+    typedef ConcurrentHashBucket<KEY, VAL> Bucket;
+
+    /* An immutable-size directory. Doubling publishes a new one. */
+    struct Directory {
+        size_t global_depth;
+        std::unique_ptr<std::atomic<Bucket*>[]> entries;
+
+        Directory(size_t global_depth)
+            : global_depth(global_depth), entries(new std::atomic<Bucket*>[(size_t) 1 << global_depth]) {}
+
+        size_t index(size_t hash_val){
+            return hash_val & (((size_t) 1 << global_depth) - 1);
+        }
+    };
+
+    /* Lock-free attempts of a lookup before it takes the bucket lock. */
+    static const size_t optimistic_reads = 8;
+
+    size_t num_slots;
+    std::atomic<size_t> num_keys;
+    std::atomic<Directory*> directory;
+    Hasher hasher;
+    std::function<size_t (KEY)> hash_func;
+
+    /* Writers hold this shared, and doubling the directory holds it exclusively. */
+    std::shared_timed_mutex resize_mutex;
+
+    /*
+        Every bucket and directory ever allocated. Buckets are never freed while the table lives, and
+        replaced directories are retired here rather than freed, since readers may still hold them.
+        Their total size is less than twice the size of the current directory.
+    */
+    std::mutex allocation_mutex;
+    std::vector<std::unique_ptr<Bucket>> all_buckets;
+    std::vector<std::unique_ptr<Directory>> all_directories;
+
+    /* Main hash function used: Hasher, unless a hash function was set with set_hash(). */
+    size_t hash(const KEY& key) {
+        if(hash_func){
+            return hash_func(key);
+        }
+        return hasher(key);
+    }
+
+    Bucket* new_bucket(size_t local_depth, size_t pattern){
+        std::lock_guard<std::mutex> guard(allocation_mutex);
+        all_buckets.emplace_back(new Bucket(local_depth, pattern, num_slots));
+        return all_buckets.back().get();
+    }
+
+    Directory* new_directory(size_t global_depth){
+        std::lock_guard<std::mutex> guard(allocation_mutex);
+        all_directories.emplace_back(new Directory(global_depth));
+        return all_directories.back().get();
+    }
+
+    /* Double directory, unless another writer already did. */
+    void double_directory(Directory* seen) {
+        std::unique_lock<std::shared_timed_mutex> exclusive(resize_mutex);
+
+        Directory* dir = directory.load(std::memory_order_relaxed);
+        if(dir != seen){
+            return;
+        }
+
+        size_t curr_size = (size_t) 1 << dir -> global_depth;
+        Directory* doubled = new_directory(dir -> global_depth + 1);
+        for(size_t i = 0; i < curr_size; ++i){
+            Bucket* bucket = dir -> entries[i].load(std::memory_order_relaxed);
+            doubled -> entries[i].store(bucket, std::memory_order_relaxed);
+            doubled -> entries[i + curr_size].store(bucket, std::memory_order_relaxed);
+        }
+
+        directory.store(doubled, std::memory_order_release);
+    }
+
+    /*
+        Split a full bucket, whose lock the caller holds, with the resize lock held shared.
+        The new bucket is filled and published in the directory before the moved keys leave the old
+        bucket, so readers find every key at every point. The new bucket stays locked until the old one
+        is cleaned up, so that no writer can touch a key that still has a stale copy.
+    */
+    void split_bucket(Bucket* bucket, Directory* dir) {
+        size_t local_depth = bucket -> local_depth.load(std::memory_order_relaxed);
+        size_t mask = (size_t) 1 << local_depth;
+        size_t pattern2 = bucket -> pattern.load(std::memory_order_relaxed) | mask;
+
+        Bucket* bucket2 = new_bucket(local_depth + 1, pattern2);
+        std::lock_guard<std::mutex> guard(bucket2 -> lock);
+
+        /* Copy the keys that move into the new bucket. */
+        size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+        size_t size2 = 0;
+        for(size_t i = 0; i < size; ++i){
+            KEY key = bucket -> keys[i].load(std::memory_order_relaxed);
+            if(hash(key) & mask){
+                bucket2 -> keys[size2].store(key, std::memory_order_relaxed);
+                bucket2 -> vals[size2].store(bucket -> vals[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                size2 += 1;
+            }
+        }
+        bucket2 -> num_keys.store(size2, std::memory_order_relaxed);
+
+        /* Point to correct buckets. */
+        size_t dir_size = (size_t) 1 << dir -> global_depth;
+        for(size_t i = pattern2; i < dir_size; i += (mask << 1)){
+            dir -> entries[i].store(bucket2, std::memory_order_release);
+        }
+
+        /* Drop the moved keys from the old bucket, compacting in place. */
+        bucket -> begin_write();
+        size_t kept = 0;
+        for(size_t i = 0; i < size; ++i){
+            KEY key = bucket -> keys[i].load(std::memory_order_relaxed);
+            if(!(hash(key) & mask)){
+                bucket -> keys[kept].store(key, std::memory_order_relaxed);
+                bucket -> vals[kept].store(bucket -> vals[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                kept += 1;
+            }
+        }
+        bucket -> num_keys.store(kept, std::memory_order_relaxed);
+        bucket -> local_depth.store(local_depth + 1, std::memory_order_relaxed);
+        bucket -> end_write();
+    }
+
+    /*
+        Run op(bucket) on the bucket holding hash_val, with its lock and the resize lock (shared) held.
+        op returns false if the bucket must be split first.
+    */
+    template <typename OP>
+    void locked_update(size_t hash_val, OP op){
+        while(true){
+            std::shared_lock<std::shared_timed_mutex> shared(resize_mutex);
+            Directory* dir = directory.load(std::memory_order_acquire);
+            Bucket* bucket = dir -> entries[dir -> index(hash_val)].load(std::memory_order_acquire);
+
+            std::unique_lock<std::mutex> guard(bucket -> lock);
+
+            /* A split moved this key range elsewhere since we read the directory. */
+            if(!bucket -> covers(hash_val)){
+                continue;
+            }
+
+            if(op(bucket)){
+                return;
+            }
+
+            /* The bucket is full. If the bucket's local depth matches the global depth, double the directory first. */
+            if(bucket -> local_depth.load(std::memory_order_relaxed) == dir -> global_depth){
+                guard.unlock();
+                shared.unlock();
+                double_directory(dir);
+            } else {
+                split_bucket(bucket, dir);
+            }
+        }
+    }
+
+    public:
+    ConcurrentExtendibleHashTable(size_t global_depth = 0, size_t num_slots = 3) : num_keys(0) {
+        this -> num_slots = num_slots;
+
+        Directory* dir = new_directory(global_depth);
+        size_t num_buckets = (size_t) 1 << global_depth;
+        for(size_t i = 0; i < num_buckets; ++i){
+            dir -> entries[i].store(new_bucket(global_depth, i), std::memory_order_relaxed);
+        }
+        directory.store(dir, std::memory_order_release);
+    }
+
+    /* Sets the hash function. Not thread-safe: call it before sharing the table. */
+    void set_hash(const std::function<size_t (KEY)>& func) {
+        assert(num_keys == 0);
+        hash_func = func;
+    }
+
+    /* Insert into the hash table, overwriting the value if the key is already present. */
+    void insert(KEY key, VAL val) {
+        locked_update(hash(key), [&](Bucket* bucket){
+            size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+            size_t slot = bucket -> find_slot(key, size);
+
+            if(slot == size && size == num_slots){
+                return false;
+            }
+
+            bucket -> begin_write();
+            bucket -> keys[slot].store(key, std::memory_order_relaxed);
+            bucket -> vals[slot].store(val, std::memory_order_relaxed);
+            if(slot == size){
+                bucket -> num_keys.store(size + 1, std::memory_order_relaxed);
+                num_keys.fetch_add(1, std::memory_order_relaxed);
+            }
+            bucket -> end_write();
+            return true;
+        });
+    }
+
+    /* Delete a key from the hash table. Returns false if the key was not present. */
+    bool remove(KEY key) {
+        bool removed = false;
+        locked_update(hash(key), [&](Bucket* bucket){
+            size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+            size_t slot = bucket -> find_slot(key, size);
+
+            if(slot == size){
+                return true;
+            }
+
+            /* Move the last key into the hole. */
+            bucket -> begin_write();
+            bucket -> keys[slot].store(bucket -> keys[size - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket -> vals[slot].store(bucket -> vals[size - 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket -> num_keys.store(size - 1, std::memory_order_relaxed);
+            bucket -> end_write();
+
+            num_keys.fetch_sub(1, std::memory_order_relaxed);
+            removed = true;
+            return true;
+        });
+        return removed;
+    }
+
+    /*
+        Looks up key, without locking unless writers keep changing its bucket. Returns true and sets val if
+        the key is present.
+    */
+    bool find(KEY key, VAL& val) {
+        size_t hash_val = hash(key);
+
+        for(size_t attempt = 0; attempt < optimistic_reads; ++attempt){
+            Directory* dir = directory.load(std::memory_order_acquire);
+            Bucket* bucket = dir -> entries[dir -> index(hash_val)].load(std::memory_order_acquire);
+
+            size_t version = bucket -> version.load(std::memory_order_acquire);
+            if(version & 1){
+                continue;
+            }
+
+            bool covered = bucket -> covers(hash_val);
+            size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+            if(size > num_slots){
+                size = num_slots;
+            }
+            size_t slot = bucket -> find_slot(key, size);
+            VAL found_val = VAL();
+            if(slot != size){
+                found_val = bucket -> vals[slot].load(std::memory_order_relaxed);
+            }
+
+            /* Retry if a writer touched the bucket meanwhile, or if a split moved the key elsewhere. */
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(bucket -> version.load(std::memory_order_relaxed) != version || !covered){
+                continue;
+            }
+
+            if(slot != size){
+                val = found_val;
+                return true;
+            }
+            return false;
+        }
+
+        /* Read under the bucket lock, which writers of the bucket take turns with. */
+        bool found = false;
+        locked_update(hash_val, [&](Bucket* bucket){
+            size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+            size_t slot = bucket -> find_slot(key, size);
+            if(slot != size){
+                val = bucket -> vals[slot].load(std::memory_order_relaxed);
+                found = true;
+            }
+            return true;
+        });
+        return found;
+    }
+
+    /* Checks if key is present in the hash table. */
+    bool count(KEY key) {
+        VAL val;
+        return find(key, val);
+    }
+
+    /* Returns the total number of key-value pairs. */
+    size_t size() {
+        return num_keys.load(std::memory_order_relaxed);
+    }
+
+    /* Returns the current global depth. */
+    size_t get_global_depth() {
+        return directory.load(std::memory_order_acquire) -> global_depth;
+    }
+};
@@ -6,210 +6,749 @@
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <cstdint>
+#include <memory>
 #include <utility>
+#include <algorithm>
 #include <functional>
+#include <iterator>
+#include <cstddef>
+#include "hashers.hpp"
+#include "probing.hpp"
+
+/* Size of a cache line, in bytes. */
+const size_t cache_line_size = 64;
+
+/* Allocator returning cache-line-aligned storage, so that bucket blocks in the slab line up with cache lines. */
+template <typename T>
+struct CacheAlignedAllocator {
+    typedef T value_type;
+
+    CacheAlignedAllocator() {}
+
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    /* Over-allocate by a line, and stash the raw pointer just before the aligned block. */
+    T* allocate(size_t n){
+        char* raw = static_cast<char*>(::operator new(n * sizeof(T) + cache_line_size));
+        char* aligned = raw + cache_line_size - (reinterpret_cast<uintptr_t>(raw) % cache_line_size);
+        reinterpret_cast<char**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, size_t){
+        ::operator delete(reinterpret_cast<char**>(p)[-1]);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const CacheAlignedAllocator<T>&, const CacheAlignedAllocator<U>&){
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const CacheAlignedAllocator<T>&, const CacheAlignedAllocator<U>&){
+    return false;
+}
+
+/* Number of elements of type T reserved per bucket, padded so that a bucket's block never straddles a cache line. */
+template <typename T>
+size_t slab_stride(size_t num_slots){
+
+    /* Odd-sized types cannot be packed along cache lines. */
+    if(cache_line_size % sizeof(T) != 0){
+        return num_slots;
+    }
+
+    /* Small blocks are padded to a power of two, so that several share a line. Larger blocks take whole lines. */
+    size_t bytes = num_slots * sizeof(T);
+    size_t padded = sizeof(T);
+    if(bytes <= cache_line_size){
+        while(padded < bytes){
+            padded *= 2;
+        }
+    } else {
+        padded = ((bytes + cache_line_size - 1) / cache_line_size) * cache_line_size;
+    }
 
+    return padded / sizeof(T);
+}
+
+/* Local depth marking a bucket of the slab as free. */
+const size_t free_depth = (size_t) -1;
+
+/*
+    All buckets of the hash table, stored in one contiguous slab.
+    Bucket 'id' owns slots [id * stride, id * stride + num_slots) of the key and value arrays.
+    Slots of a bucket are kept packed: only the first sizes[id] of them hold keys.
+    Every slot also carries a one-byte fingerprint of its key's hash, so probes compare a whole group of
+    fingerprints at once and only look at keys whose fingerprint matches.
+    Buckets released by merges go on a free list, and later splits reuse their blocks. Once most of the
+    slab is free, compact() moves the live buckets to the front and gives the rest back.
+*/
 template <typename KEY, typename VAL>
-class HashBucket {
+class BucketSlab {
 
-	public:
-	size_t local_depth;
-	size_t max_slots;
-	std::vector<std::pair<KEY, VAL>> slots;
+    public:
+    size_t num_slots;
+    size_t key_stride;
+    size_t val_stride;
+    size_t tag_stride;
+    std::vector<size_t> local_depths;
+    std::vector<size_t> sizes;
+    std::vector<size_t> free_ids;
+
+    /* Number of live buckets with each local depth. */
+    std::vector<size_t> depth_counts;
+    std::vector<KEY, CacheAlignedAllocator<KEY>> keys;
+    std::vector<VAL, CacheAlignedAllocator<VAL>> vals;
+    std::vector<uint8_t, CacheAlignedAllocator<uint8_t>> tags;
+
+    BucketSlab(size_t num_slots){
+        this -> num_slots = num_slots;
+        this -> key_stride = slab_stride<KEY>(num_slots);
+        this -> val_stride = slab_stride<VAL>(num_slots);
 
-	HashBucket(size_t local_depth, size_t max_slots){
-        this -> local_depth = local_depth;
-		this -> max_slots = max_slots;
+        /* Fingerprints are padded to whole groups, so probes never read past a bucket's block. */
+        this -> tag_stride = ((num_slots + tag_group_width - 1) / tag_group_width) * tag_group_width;
+    }
 
-        slots.reserve(max_slots);
-	}
+    /* Take a free bucket, or carve a new one out of the slab, and return its id. */
+    size_t allocate(size_t local_depth){
+        size_t id;
 
-	/* Insert into this bucket. */
-	void insert(std::pair<KEY, VAL> keyval){
+        if(!free_ids.empty()){
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = sizes.size();
+            local_depths.push_back(local_depth);
+            sizes.push_back(0);
+            keys.resize((id + 1) * key_stride);
+            vals.resize((id + 1) * val_stride);
+            tags.resize((id + 1) * tag_stride);
+        }
 
-        /* Should not be full. */
-        assert(!isFull());
+        local_depths[id] = local_depth;
+        if(depth_counts.size() <= local_depth){
+            depth_counts.resize(local_depth + 1);
+        }
+        depth_counts[local_depth] += 1;
 
-        for(size_t i = 0; i < slots.size(); ++i){
-            /* Check slots. Overwrite old key-value pair. */
-            if(slots[i].first == keyval.first){
-                slots[i].second = keyval.second;
-                return;
+        return id;
+    }
+
+    /* Put an empty bucket on the free list. */
+    void release(size_t id){
+        assert(isEmpty(id));
+
+        depth_counts[local_depths[id]] -= 1;
+        local_depths[id] = free_depth;
+        free_ids.push_back(id);
+    }
+
+    /* Change the local depth of bucket id. */
+    void set_local_depth(size_t id, size_t local_depth){
+        depth_counts[local_depths[id]] -= 1;
+        local_depths[id] = local_depth;
+        if(depth_counts.size() <= local_depth){
+            depth_counts.resize(local_depth + 1);
+        }
+        depth_counts[local_depth] += 1;
+    }
+
+    /* Number of live buckets with this local depth. */
+    size_t count_depth(size_t local_depth){
+        return local_depth < depth_counts.size() ? depth_counts[local_depth] : 0;
+    }
+
+    /* True if bucket id is on the free list. */
+    bool isFree(size_t id){
+        return local_depths[id] == free_depth;
+    }
+
+    /* Reserve room for this many buckets, so that splits do not reallocate the slab. */
+    void reserve(size_t num_buckets){
+        local_depths.reserve(num_buckets);
+        sizes.reserve(num_buckets);
+        keys.reserve(num_buckets * key_stride);
+        vals.reserve(num_buckets * val_stride);
+        tags.reserve(num_buckets * tag_stride);
+    }
+
+    /* Move the pairs of bucket from_id, with its depth and fingerprints, into the free block of bucket to_id. */
+    void move_bucket(size_t from_id, size_t to_id){
+        for(size_t i = 0; i < sizes[from_id]; ++i){
+            bucket_keys(to_id)[i] = std::move(bucket_keys(from_id)[i]);
+            bucket_vals(to_id)[i] = std::move(bucket_vals(from_id)[i]);
+            bucket_keys(from_id)[i] = KEY();
+            bucket_vals(from_id)[i] = VAL();
+        }
+        std::copy(bucket_tags(from_id), bucket_tags(from_id) + tag_stride, bucket_tags(to_id));
+        local_depths[to_id] = local_depths[from_id];
+        sizes[to_id] = sizes[from_id];
+        local_depths[from_id] = free_depth;
+        sizes[from_id] = 0;
+    }
+
+    /*
+        Move all live buckets to the lowest ids, keeping their order, and free the memory of the rest.
+        Returns the new id of every old bucket, for the directory to be rewritten.
+    */
+    std::vector<size_t> compact(){
+        std::vector<size_t> new_ids(sizes.size(), free_depth);
+        size_t live = 0;
+        for(size_t id = 0; id < sizes.size(); ++id){
+            if(isFree(id)){
+                continue;
             }
+            if(id != live){
+                move_bucket(id, live);
+            }
+            new_ids[id] = live;
+            live += 1;
         }
 
-        /* Key not found already. */
-		slots.push_back(keyval);
+        local_depths.resize(live);
+        sizes.resize(live);
+        keys.resize(live * key_stride);
+        vals.resize(live * val_stride);
+        tags.resize(live * tag_stride);
+        local_depths.shrink_to_fit();
+        sizes.shrink_to_fit();
+        keys.shrink_to_fit();
+        vals.shrink_to_fit();
+        tags.shrink_to_fit();
+        free_ids.clear();
+        free_ids.shrink_to_fit();
+
+        return new_ids;
+    }
 
-        /* Invariant. */
-        assert(slots.size() <= max_slots);
-	}
+    /* Number of buckets the slab has room for without reallocating, free ones included. */
+    size_t capacity(){
+        return keys.capacity() / key_stride;
+    }
+
+    /* Number of buckets carved out of the slab, including free ones. */
+    size_t num_buckets(){
+        return sizes.size();
+    }
 
-	/* Remove the last element in this bucket and return it. */
-	std::pair<KEY, VAL> pop(){
-		assert((slots.size() > 0) && (slots.size() <= max_slots));
+    /* Number of buckets in use. */
+    size_t num_live_buckets(){
+        return sizes.size() - free_ids.size();
+    }
 
-		std::pair<KEY, VAL> deleted;
-		deleted = slots.back();
-		slots.pop_back();
+    /* Keys of bucket id. */
+    KEY* bucket_keys(size_t id){
+        return keys.data() + id * key_stride;
+    }
 
-        /* Invariant. */
-        assert(slots.size() <= max_slots);
+    /* Values of bucket id. */
+    VAL* bucket_vals(size_t id){
+        return vals.data() + id * val_stride;
+    }
 
-        return deleted;
-	}
+    /* Fingerprints of bucket id. */
+    uint8_t* bucket_tags(size_t id){
+        return tags.data() + id * tag_stride;
+    }
 
-    /* Checks if key is present in this bucket. */
-    bool count(KEY key){
-        for(size_t i = 0; i < slots.size(); ++i){
+    /* Start loading the first lines of bucket id, which a probe reads first. */
+    void prefetch_bucket(size_t id){
+        prefetch(bucket_tags(id));
+        prefetch(bucket_keys(id));
+    }
 
-            /* Check slots. */
-            if(slots[i].first == key){
-                return true;
+    /*
+        Returns the slot holding key (with fingerprint tag) in bucket id, or num_slots if the key is absent.
+        key may be of any type comparable with KEY, such as a std::string_view for std::string keys.
+    */
+    template <typename K>
+    size_t find_slot(size_t id, const K& key, uint8_t tag){
+        KEY* bucket = bucket_keys(id);
+        uint8_t* bucket_tag = bucket_tags(id);
+        size_t size = sizes[id];
+
+        for(size_t group = 0; group < size; group += tag_group_width){
+            uint32_t matches = match_tag_group(bucket_tag + group, tag);
+
+            /* Ignore slots past the end of the bucket. */
+            if(size - group < 32){
+                matches &= ((uint32_t) 1 << (size - group)) - 1;
+            }
+
+            /* Only fingerprint matches are compared against the full key. */
+            while(matches){
+                size_t i = group + lowest_bit(matches);
+                if(bucket[i] == key){
+                    return i;
+                }
+                matches &= matches - 1;
             }
         }
 
-        return false;
+        return num_slots;
     }
 
-    /* Delete key from bucket. */
-    void remove(KEY key){
-        assert(count(key));
+    /*
+        Append a key known to be absent to bucket id, moving from it when given an rvalue, and return its slot.
+        The caller assigns the slot's value.
+    */
+    template <typename K>
+    size_t append(size_t id, K&& key, uint8_t tag){
+        assert(!isFull(id));
+
+        size_t slot = sizes[id];
+        bucket_keys(id)[slot] = std::forward<K>(key);
+        bucket_tags(id)[slot] = tag;
+        sizes[id] += 1;
+        return slot;
+    }
 
-        /* Check slots. */
-        for(size_t i = 0; i < slots.size(); ++i){
-            if(slots[i].first == key){
-                slots.erase(slots.begin() + i);
-                return;
-            }
+    /* Checks if key is present in bucket id. */
+    template <typename K>
+    bool count(size_t id, const K& key, uint8_t tag){
+        return find_slot(id, key, tag) != num_slots;
+    }
+
+    /*
+        Close the hole at slot of bucket id by moving the last pair of the bucket into it, then reset the vacated
+        last slot, so that whatever its key and value own is released now rather than when the slot is reused.
+    */
+    void fill_hole(size_t id, size_t slot){
+        size_t last = sizes[id] - 1;
+        if(slot != last){
+            bucket_keys(id)[slot] = std::move(bucket_keys(id)[last]);
+            bucket_vals(id)[slot] = std::move(bucket_vals(id)[last]);
+            bucket_tags(id)[slot] = bucket_tags(id)[last];
         }
+        bucket_keys(id)[last] = KEY();
+        bucket_vals(id)[last] = VAL();
+        sizes[id] -= 1;
     }
 
-	/* Get the number of keys in this bucket. */
-	size_t size(){
-		return slots.size();
-	}
+    /* Delete key from bucket id, by moving the last key of the bucket into its slot. */
+    template <typename K>
+    void remove(size_t id, const K& key, uint8_t tag){
+        size_t slot = find_slot(id, key, tag);
+        assert(slot != num_slots);
 
-	/* True if the bucket has no keys. */
-	bool isEmpty(){
-		return slots.size() == 0;
-	}
+        fill_hole(id, slot);
+    }
 
-	/* True if the bucket is full. */
-	bool isFull(){
-		return slots.size() == max_slots;
-	}
+    /* Move the key-value pair in slot of bucket from_id to the end of bucket to_id. */
+    void move_slot(size_t from_id, size_t slot, size_t to_id){
+        assert(!isFull(to_id));
+
+        size_t dest = sizes[to_id];
+        bucket_keys(to_id)[dest] = std::move(bucket_keys(from_id)[slot]);
+        bucket_vals(to_id)[dest] = std::move(bucket_vals(from_id)[slot]);
+        bucket_tags(to_id)[dest] = bucket_tags(from_id)[slot];
+        sizes[to_id] += 1;
+
+        /* Fill the hole with the last pair of the source bucket. */
+        fill_hole(from_id, slot);
+    }
+
+    /* True if bucket id has no keys. */
+    bool isEmpty(size_t id){
+        return sizes[id] == 0;
+    }
+
+    /* True if bucket id is full. */
+    bool isFull(size_t id){
+        return sizes[id] == num_slots;
+    }
 
-	/* Print the contents of this bucket. */
-	void print(){
-		if(isEmpty()){
-			std::cout << "Empty." << "\n";
+    /* Print the contents of bucket id. */
+    void print(size_t id){
+        if(isEmpty(id)){
+            std::cout << "Empty." << "\n";
             return;
-		}
+        }
 
-		for(size_t i = 0; i < slots.size(); ++i){
-			std::cout << slots[i].first << ":" << slots[i].second << " | ";
-		}
-		std::cout << "\n";
-	}
+        for(size_t i = 0; i < sizes[id]; ++i){
+            std::cout << bucket_keys(id)[i] << ":" << bucket_vals(id)[i] << " | ";
+        }
+        std::cout << "\n";
+    }
 };
 
-template <typename KEY, typename VAL>
+/* Marks an entry of the old directory which was already copied to the new one, during incremental doubling. */
+const size_t directory_forwarded = (size_t) 1 << (sizeof(size_t) * 8 - 1);
+
+/* Number of keys whose directory entries and buckets are loaded ahead of probing, in batch operations. */
+const size_t batch_window = 16;
+
+/*
+    Doubling the directory is incremental: the doubled directory is allocated without being filled, and
+    the old one is kept alongside it. Every later insert or remove copies the next migration_chunk old
+    entries into both halves of the new directory, so no single operation pays for the whole copy.
+    Until old entry i is copied, it stays authoritative for new entries i and i + old size.
+    Splits may need to change an entry that is not copied yet: that entry is copied right away, and
+    marked as forwarded in the old directory.
+    Skewed inserts may double the directory again before a copy is done, even several times within one
+    insert. The old directories are then chained, oldest first: a lookup walks up the chain from the oldest
+    directory until it reaches an entry not copied yet, and migration finishes the oldest copy first.
+
+    Removes merge a bucket with its buddy (the bucket differing only in the top bit of their local depth)
+    once both together fill at most merge_fill of one bucket, and halve the directory once every bucket's
+    local depth is at least two below the global depth. Since splits happen only on full buckets, a
+    workload sitting near either boundary does not keep splitting and merging.
+*/
+template <typename KEY, typename VAL, typename Hasher = MixHash<KEY>>
 class ExtendibleHashTable {
 
     size_t global_depth;
     size_t num_slots;
     size_t num_keys;
-    std::vector<int> directory;
-	std::vector<HashBucket<KEY, VAL>> buckets;
+    size_t directory_size;
+    std::unique_ptr<size_t[]> directory;
+
+    /* Directories still being copied, oldest first: old_directories[j] has directory_size >> (number of them - j) entries. */
+    std::vector<std::unique_ptr<size_t[]>> old_directories;
+
+    /* Number of entries of old_directories[j] copied into the next directory of the chain. */
+    std::vector<size_t> migrated;
+    size_t migration_chunk;
+    double merge_fill;
+    BucketSlab<KEY, VAL> buckets;
+    Hasher hasher;
     std::function<size_t (KEY)> hash_func;
 
-    /* Main hash function used. Initially, the identity function. */
-	size_t hash(KEY key) {
+    /* Main hash function used: Hasher, unless a hash function was set with set_hash(). */
+	size_t hash(const KEY& key) {
         if(hash_func){
             return hash_func(key);
-        } else {
-            return key;
         }
+        return hasher(key);
 	}
 
+    /* Hash a key of another type, which a transparent Hasher must hash exactly as the equal KEY. */
+    template <typename K>
+    size_t hash(const K& key) {
+        if(hash_func){
+            return hash_func(KEY(key));
+        }
+        return hasher(key);
+    }
+
+    /* Enables the heterogeneous lookup overloads for key type K, only if Hasher is transparent and K is not KEY. */
+    template <typename K>
+    struct heterogeneous_key : std::enable_if<is_transparent_hasher<Hasher>::value && !std::is_same<K, KEY>::value> {};
+
+    /* Searches for a key of KEY or a heterogeneous type. Returns the directory index if found, and -1 if not. */
+    template <typename K>
+    int search_key(const K& key) {
+        size_t hash_val = hash(key);
+        size_t index = get_bucket_index_from_hash(hash_val);
+
+        if(buckets.count(directory_entry(index), key, hash_tag(hash_val))){
+            return (int) index;
+        } else {
+            return -1;
+        }
+    }
+
+    /* Looks up a key of KEY or a heterogeneous type. Returns a pointer to its value, or NULL if absent. */
+    template <typename K>
+    VAL* find_key(const K& key) {
+        size_t hash_val = hash(key);
+        size_t id = directory_entry(get_bucket_index_from_hash(hash_val));
+        size_t slot = buckets.find_slot(id, key, hash_tag(hash_val));
+
+        return (slot == num_slots) ? NULL : buckets.bucket_vals(id) + slot;
+    }
+
+    /* Deletes a key of KEY or a heterogeneous type, which must be present. */
+    template <typename K>
+    void remove_key(const K& key) {
+
+        /* Spread any pending directory copy over removes. */
+        migrate_step(migration_chunk);
+
+        /* Key must be present in the hash table. */
+        size_t hash_val = hash(key);
+        int index = search_key(key);
+        assert(index != -1);
+
+        /* Delete from corresponding bucket. */
+        buckets.remove(directory_entry(index), key, hash_tag(hash_val));
+        num_keys -= 1;
+
+        merge_buckets(index);
+    }
+
+    /* Entries of the directory at position level of the chain, where the current directory comes last. */
+    size_t* directory_level(size_t level) {
+        return level == old_directories.size() ? directory.get() : old_directories[level].get();
+    }
+
+    /*
+        Position in the chain of the directory holding the authoritative entry for this index. Entries are only
+        valid once copied from the previous directory, so the walk starts from the oldest one, which is complete.
+    */
+    size_t authoritative_level(size_t index) {
+        size_t num_old = old_directories.size();
+        size_t level = 0;
+        while(level < num_old){
+            size_t old_index = index & ((directory_size >> (num_old - level)) - 1);
+            if(old_index >= migrated[level] && !(old_directories[level][old_index] & directory_forwarded)){
+                break;
+            }
+            level += 1;
+        }
+        return level;
+    }
+
+    /* Get the id of the bucket at this directory index. */
+    size_t directory_entry(size_t index) {
+        if(old_directories.empty()){
+            return directory[index];
+        }
+
+        size_t level = authoritative_level(index);
+        return directory_level(level)[index & ((directory_size >> (old_directories.size() - level)) - 1)];
+    }
+
+    /* Point this directory index at bucket id, first copying its entry up the chain if it is still pending. */
+    void set_directory_entry(size_t index, size_t id) {
+        for(size_t level = authoritative_level(index); level < old_directories.size(); ++level){
+            forward_entry(level, index & ((directory_size >> (old_directories.size() - level)) - 1));
+        }
+        directory[index] = id;
+    }
+
+    /* Start loading the directory entry at this index. */
+    void prefetch_directory_entry(size_t index) {
+        if(!old_directories.empty()){
+            prefetch(&old_directories.back()[index & ((directory_size >> 1) - 1)]);
+        }
+        prefetch(&directory[index]);
+    }
+
+    /* Copy one authoritative entry of the directory at position level of the chain to both halves of the next one. */
+    void forward_entry(size_t level, size_t old_index) {
+        size_t half = directory_size >> (old_directories.size() - level);
+        size_t* next = directory_level(level + 1);
+        next[old_index] = old_directories[level][old_index];
+        next[old_index + half] = old_directories[level][old_index];
+        old_directories[level][old_index] |= directory_forwarded;
+    }
+
+    /* Copy the next chunk of entries along the chain of old directories, oldest first, if a doubling is in progress. */
+    void migrate_step(size_t chunk) {
+        while(chunk > 0 && !old_directories.empty()){
+            size_t half = directory_size >> old_directories.size();
+            size_t end = (half - migrated[0] > chunk) ? migrated[0] + chunk : half;
+            for(size_t i = migrated[0]; i < end; ++i){
+                if(!(old_directories[0][i] & directory_forwarded)){
+                    forward_entry(0, i);
+                }
+            }
+            chunk -= end - migrated[0];
+            migrated[0] = end;
+
+            /* The next directory of the chain is complete. */
+            if(migrated[0] == half){
+                old_directories.erase(old_directories.begin());
+                migrated.erase(migrated.begin());
+            }
+        }
+    }
+
     /* Split bucket with index. */
     void split_bucket(size_t index) {
 
-        size_t local_depth = buckets[directory[index]].local_depth;
-        size_t index1 = index & ((1 << local_depth) - 1);
-        size_t index2 = index1 + (1 << local_depth);
+        size_t old_id = directory_entry(index);
+        size_t local_depth = buckets.local_depths[old_id];
+        size_t index2 = (index & (((size_t) 1 << local_depth) - 1)) + ((size_t) 1 << local_depth);
 
-        /* Create new bucket for the split. */
-        HashBucket<KEY, VAL> new_bucket(local_depth, num_slots);
-        buckets.push_back(new_bucket);
-        directory[index2] = buckets.size() - 1;
+        /* Create new bucket for the split, from the slab. */
+        size_t new_id = buckets.allocate(local_depth + 1);
+        buckets.set_local_depth(old_id, local_depth + 1);
 
         /* Rehash values for this split bucket. */
-        rehash(index1, index2, (1 << local_depth));
+        rehash(old_id, new_id, (size_t) 1 << local_depth);
 
-        /* Posize_t to correct buckets. */
-        for(size_t i = index2 + (2 << local_depth); i < (1 << global_depth); i += (2 << local_depth)){
-            directory[i] = directory[index2];
-        };
+        /* Point to correct buckets. */
+        for(size_t i = index2; i < directory_size; i += ((size_t) 2 << local_depth)){
+            set_directory_entry(i, new_id);
+        }
     }
 
-    /* Rehash between buckets with indices. */
-	void rehash(size_t index1, size_t index2, size_t mask) {
-        HashBucket<KEY, VAL>& bucket1 = buckets[directory[index1]];
-        HashBucket<KEY, VAL>& bucket2 = buckets[directory[index2]];
+    /* Rehash between buckets with ids, in place: only keys with the mask bit set move to the second bucket. */
+	void rehash(size_t id1, size_t id2, size_t mask) {
+        assert(buckets.isEmpty(id2));
 
-        bucket1.local_depth += 1;
-        bucket2.local_depth = bucket1.local_depth;
+        size_t i = 0;
+        while(i < buckets.sizes[id1]){
+            if(hash(buckets.bucket_keys(id1)[i]) & mask){
+                buckets.move_slot(id1, i, id2);
+            } else {
+                i += 1;
+            }
+        }
+	}
 
-        std::vector<std::pair<KEY, VAL>> items;
-		std::pair<KEY, VAL> item;
-		size_t index;
+    /*
+        Double directory, and increase global depth by 1. The entries are copied over later, by migrate_step().
+        A doubling still in progress is not finished first: the current directory joins the chain of old ones.
+    */
+    void double_directory() {
+        old_directories.push_back(std::move(directory));
+        migrated.push_back(0);
+        directory.reset(new size_t[directory_size * 2]);
+        directory_size *= 2;
+        global_depth += 1;
+    }
 
-		while (!bucket1.isEmpty()){
-			item = bucket1.pop();
-			items.push_back(item);
-		}
+    /* Merge the bucket at directory index with its buddy while they fit together, then shrink the directory if possible. */
+    void merge_buckets(size_t index) {
+        size_t id = directory_entry(index);
+        size_t local_depth = buckets.local_depths[id];
 
-        assert(bucket1.isEmpty());
-        assert(bucket2.isEmpty());
+        while(local_depth > 0){
+            size_t top_bit = (size_t) 1 << (local_depth - 1);
+            size_t pattern = index & ((top_bit << 1) - 1);
+            size_t buddy_id = directory_entry(pattern ^ top_bit);
 
-		for (size_t i = 0; i < items.size(); ++i){
-			item = items[i];
+            /* The buddy must not be split further, and both must fit within the merge threshold. */
+            if(buckets.local_depths[buddy_id] != local_depth){
+                break;
+            }
+            if(buckets.sizes[id] + buckets.sizes[buddy_id] > merge_fill * num_slots){
+                break;
+            }
 
-            /* Recompute bucket index, based on mask. */
-            if(hash(item.first) & mask){
-                index = index2;
-            } else {
-                index = index1;
+            /* Keep the bucket without the top bit, and move everything from the other one into it. */
+            size_t low_id = (pattern & top_bit) ? buddy_id : id;
+            size_t high_id = (pattern & top_bit) ? id : buddy_id;
+            while(!buckets.isEmpty(high_id)){
+                buckets.move_slot(high_id, buckets.sizes[high_id] - 1, low_id);
             }
 
-            /* Reinsert based on this hash value. */
-			buckets[directory[index]].insert(item);
-		}
-	}
+            /* Point to correct buckets. */
+            for(size_t i = pattern | top_bit; i < directory_size; i += (top_bit << 1)){
+                set_directory_entry(i, low_id);
+            }
+            buckets.set_local_depth(low_id, local_depth - 1);
+            buckets.release(high_id);
 
-    /* Double directory, and increase global depth by 1. */
-    void double_directory() {
-        size_t curr_size = directory.size();
-        for(size_t i = 0; i < curr_size; ++i){
-            directory.push_back(directory[i]);
+            id = low_id;
+            local_depth -= 1;
+        }
+
+        while(global_depth >= 2 && buckets.count_depth(global_depth) == 0 && buckets.count_depth(global_depth - 1) == 0){
+            halve_directory();
+        }
+    }
+
+    /* Halve directory, and decrease global depth by 1. Both halves are identical once no bucket uses the top bit. */
+    void halve_directory() {
+
+        /* The old directories hold fewer entries than the current one, all together. */
+        migrate_step(directory_size);
+
+        size_t half = directory_size >> 1;
+        std::unique_ptr<size_t[]> halved(new size_t[half]);
+        for(size_t i = 0; i < half; ++i){
+            halved[i] = directory[i];
+        }
+
+        directory = std::move(halved);
+        directory_size = half;
+        global_depth -= 1;
+
+        /* Give back the slab memory of merged buckets once they make up most of it. */
+        if(buckets.free_ids.size() * 2 > buckets.num_buckets()){
+            std::vector<size_t> new_ids = buckets.compact();
+            for(size_t i = 0; i < directory_size; ++i){
+                directory[i] = new_ids[directory[i]];
+            }
         }
-        global_depth += 1;
     }
 
 	public:
-	ExtendibleHashTable(size_t global_depth = 0, size_t num_slots = 3) {
+    /*
+        Forward iterator over all key-value pairs. It walks the slab in order, so every bucket is visited once,
+        however many directory entries point to it, and a full scan reads the key and value arrays sequentially.
+        Dereferencing gives a pair of references to the key and its value. Invalidated by inserts and removes.
+    */
+    class iterator {
+        BucketSlab<KEY, VAL>* slab;
+        size_t id;
+        size_t slot;
+
+        /* Move past empty and free buckets, to the next pair or the end. */
+        void skip_empty() {
+            while(id < slab -> num_buckets() && slot >= slab -> sizes[id]){
+                id += 1;
+                slot = 0;
+            }
+        }
+
+        public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const KEY&, VAL&> value_type;
+        typedef value_type reference;
+        typedef void pointer;
+        typedef std::ptrdiff_t difference_type;
+
+        iterator(BucketSlab<KEY, VAL>* slab, size_t id) : slab(slab), id(id), slot(0) {
+            skip_empty();
+        }
+
+        const KEY& key() const {
+            return slab -> bucket_keys(id)[slot];
+        }
+
+        VAL& value() const {
+            return slab -> bucket_vals(id)[slot];
+        }
+
+        reference operator*() const {
+            return reference(key(), value());
+        }
+
+        iterator& operator++() {
+            slot += 1;
+            skip_empty();
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++(*this);
+            return old;
+        }
+
+        bool operator==(const iterator& other) const {
+            return id == other.id && slot == other.slot;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+	ExtendibleHashTable(size_t global_depth = 0, size_t num_slots = 3) : buckets(num_slots) {
 
         this -> global_depth = global_depth;
         this -> num_slots = num_slots;
         this -> num_keys = 0;
+        this -> migration_chunk = 1024;
+        this -> merge_fill = 0.5;
 
-        size_t num_buckets = 1 << global_depth;
-		HashBucket<KEY, VAL> new_bucket(global_depth, num_slots);
+        size_t num_buckets = (size_t) 1 << global_depth;
+        directory_size = num_buckets;
+        directory.reset(new size_t[num_buckets]);
+        buckets.reserve(num_buckets);
         for(size_t i = 0; i < num_buckets; ++i){
-            directory.push_back(i);
-            (this -> buckets).push_back(new_bucket);
+            directory[i] = buckets.allocate(global_depth);
         }
 	}
 
@@ -219,66 +758,237 @@ class ExtendibleHashTable {
 		hash_func = func;
 	}
 
+    /* Sets how full, as a fraction of one bucket, two buddy buckets may be together for a remove to merge them. */
+    void set_merge_fill(double fill) {
+        assert(fill >= 0 && fill < 1);
+        merge_fill = fill;
+    }
+
+    /* Sets how many directory entries each insert or remove copies while the directory is being doubled. */
+    void set_migration_chunk(size_t chunk) {
+        assert(chunk > 0);
+        migration_chunk = chunk;
+    }
+
 	/* Get bucket index corresponding to this key. */
 	size_t get_bucket_index(KEY key) {
-		return hash(key) & ((1 << global_depth) - 1);
+		return hash(key) & (((size_t) 1 << global_depth) - 1);
 	}
 
-	/* Insert into the hash table according to the hash function. */
-	void insert(KEY key, VAL val) {
+    /* Get bucket index corresponding to a hash value. */
+    size_t get_bucket_index_from_hash(size_t hash_val) {
+        return hash_val & (((size_t) 1 << global_depth) - 1);
+    }
 
-        /* Get the index of the bucket we're supposed to insert this key-value pair at. */
-		size_t index = get_bucket_index(key);
+    /*
+        Find the value slot of a key, whose hash value is already computed, adding the key if absent.
+        Returns the slot and whether the key was added, in which case the caller must assign its value.
+        The key is moved in when given as an rvalue.
+    */
+    template <typename K>
+    std::pair<VAL*, bool> find_or_add_hashed(K&& key, size_t hash_val) {
+
+        /* Get the index of the bucket we're supposed to insert this key at. */
+		size_t index = get_bucket_index_from_hash(hash_val);
+        size_t id = directory_entry(index);
+        uint8_t tag = hash_tag(hash_val);
+
+        /* The key may already be present. */
+        size_t slot = buckets.find_slot(id, key, tag);
+        if(slot != num_slots){
+            return std::make_pair(buckets.bucket_vals(id) + slot, false);
+        }
 
         /* Check if the bucket is full. */
-        if (buckets[directory[index]].isFull()){
+        if (buckets.isFull(id)){
 
             /* If the bucket's local depth matches the global depth, then we have to double the directory first. */
-            if(buckets[directory[index]].local_depth == global_depth){
+            if(buckets.local_depths[id] == global_depth){
                 double_directory();
             }
 
             /* Split only this bucket. */
             split_bucket(index);
 
-            /* Try inserting again, recursively. */
-            insert(key, val);
+            /* Try inserting again, recursively. Nothing has been moved from key yet. */
+            return find_or_add_hashed(std::forward<K>(key), hash_val);
         } else {
+            slot = buckets.append(id, std::forward<K>(key), tag);
+            num_keys += 1;
+            return std::make_pair(buckets.bucket_vals(id) + slot, true);
+        }
+    }
 
-            /* Check if we overwrite an existing key. Increment num_keys accordingly. */
-            int old_bucket_size = buckets[directory[index]].size();
-            buckets[directory[index]].insert(std::make_pair(key, val));
-            int new_bucket_size = buckets[directory[index]].size();
+    /* Insert a key, whose hash value is already computed. The key and value are moved in when given as rvalues. */
+    template <typename K, typename V>
+    void insert_hashed(K&& key, V&& val, size_t hash_val) {
 
-            num_keys += new_bucket_size - old_bucket_size;
-        }
+        /* Overwrites the value if the key is already present. */
+        *find_or_add_hashed(std::forward<K>(key), hash_val).first = std::forward<V>(val);
+    }
+
+	/* Insert into the hash table according to the hash function. The key and value are moved in when given as rvalues. */
+    template <typename K, typename V>
+	void insert(K&& key, V&& val) {
+
+        /* Spread any pending directory copy over inserts. */
+        migrate_step(migration_chunk);
+
+        size_t hash_val = hash(key);
+        insert_hashed(std::forward<K>(key), std::forward<V>(val), hash_val);
 	}
 
-    /* Searches for the key in the hash table. Returns the index of the bucket if found, and -1 if not. */
-    int search(KEY key) {
-        size_t index = get_bucket_index(key);
+    /*
+        Insert a key-value pair constructed in place from args, as for std::pair<KEY, VAL>.
+        Like insert(), overwrites the value if the key is already present.
+    */
+    template <typename... Args>
+    void emplace(Args&&... args) {
+        std::pair<KEY, VAL> item(std::forward<Args>(args)...);
+        insert(std::move(item.first), std::move(item.second));
+    }
 
-        if(buckets[directory[index]].count(key)){
-            return (int) index;
-        } else {
-            return -1;
+    /*
+        Insert a value constructed from args, only if the key is absent: unlike emplace(), args are left untouched
+        if the key is present. Returns a pointer to the key's value, and whether it was inserted.
+    */
+    template <typename K, typename... Args>
+    std::pair<VAL*, bool> try_emplace(K&& key, Args&&... args) {
+        migrate_step(migration_chunk);
+
+        size_t hash_val = hash(key);
+        std::pair<VAL*, bool> result = find_or_add_hashed(std::forward<K>(key), hash_val);
+        if(result.second){
+            *result.first = VAL(std::forward<Args>(args)...);
         }
+        return result;
     }
 
-    /* Delete a key from the hash table. */
-    void remove(KEY key) {
+    /* Returns a reference to the value of key, inserting a default-constructed value first if it is absent. */
+    VAL& operator[](const KEY& key) {
+        return *try_emplace(key).first;
+    }
 
-        /* Key must be present in the hash table. */
-        size_t index = search(key);
-        assert(index != -1);
+    VAL& operator[](KEY&& key) {
+        return *try_emplace(std::move(key)).first;
+    }
 
-        /* Delete from corresponding bucket. */
-        buckets[directory[index]].remove(key);
+    /*
+        Insert a range of key-value pairs, such as std::pair<KEY, VAL>.
+        Keys are hashed and their directory entries and buckets loaded a window at a time, before any of
+        them is inserted, so that the cache misses of the whole window overlap.
+    */
+    template <typename ForwardIt>
+    void insert_batch(ForwardIt first, ForwardIt last) {
+        size_t hash_vals[batch_window];
+
+        while(first != last){
+            ForwardIt window_first = first;
+            size_t n = 0;
+            for(; n < batch_window && first != last; ++n, ++first){
+                hash_vals[n] = hash(first -> first);
+                prefetch_directory_entry(get_bucket_index_from_hash(hash_vals[n]));
+            }
+
+            for(size_t i = 0; i < n; ++i){
+                buckets.prefetch_bucket(directory_entry(get_bucket_index_from_hash(hash_vals[i])));
+            }
+
+            /* Splits may move keys around meanwhile: the prefetches are only hints. */
+            for(size_t i = 0; i < n; ++i, ++window_first){
+                migrate_step(migration_chunk);
+                insert_hashed(window_first -> first, window_first -> second, hash_vals[i]);
+            }
+        }
+    }
+
+    /*
+        Look up many keys at once, loading their directory entries and buckets a window at a time, before probing.
+        Sets out[i] to a pointer to the value of keys[i], or NULL if absent. The pointers are valid until
+        the next insert or remove.
+    */
+    void find_batch(const std::vector<KEY>& keys, std::vector<VAL*>& out) {
+        size_t hash_vals[batch_window];
+        size_t ids[batch_window];
+        out.resize(keys.size());
+
+        for(size_t start = 0; start < keys.size(); start += batch_window){
+            size_t n = std::min(batch_window, keys.size() - start);
+
+            for(size_t i = 0; i < n; ++i){
+                hash_vals[i] = hash(keys[start + i]);
+                prefetch_directory_entry(get_bucket_index_from_hash(hash_vals[i]));
+            }
+
+            for(size_t i = 0; i < n; ++i){
+                ids[i] = directory_entry(get_bucket_index_from_hash(hash_vals[i]));
+                buckets.prefetch_bucket(ids[i]);
+            }
+
+            for(size_t i = 0; i < n; ++i){
+                size_t slot = buckets.find_slot(ids[i], keys[start + i], hash_tag(hash_vals[i]));
+                out[start + i] = (slot == num_slots) ? NULL : buckets.bucket_vals(ids[i]) + slot;
+            }
+        }
+    }
+
+    /* Searches for the key in the hash table. Returns the index of the bucket if found, and -1 if not. */
+    int search(const KEY& key) {
+        return search_key(key);
+    }
+
+    /*
+        Heterogeneous lookup: with a transparent Hasher (see hashers.hpp), key may be of another type comparable
+        with KEY, such as a std::string_view or a C string for std::string keys, and no KEY is built to look it up.
+    */
+    template <typename K, typename = typename heterogeneous_key<K>::type>
+    int search(const K& key) {
+        return search_key(key);
+    }
+
+    /*
+        Returns a pointer to the value of key, or NULL if it is absent, in a single probe.
+        The pointer is valid until the next insert or remove.
+    */
+    VAL* find(const KEY& key) {
+        return find_key(key);
+    }
+
+    /* Looks up a key of another type, as for search(). */
+    template <typename K, typename = typename heterogeneous_key<K>::type>
+    VAL* find(const K& key) {
+        return find_key(key);
+    }
+
+    /* Delete a key from the hash table. */
+    void remove(const KEY& key) {
+        remove_key(key);
+    }
+
+    /* Delete a key of another type, as for search(). */
+    template <typename K, typename = typename heterogeneous_key<K>::type>
+    void remove(const K& key) {
+        remove_key(key);
     }
 
     /* Checks if key is present in the hash table. */
-    bool count(KEY key) {
-        return (search(key) != -1);
+    bool count(const KEY& key) {
+        return (search_key(key) != -1);
+    }
+
+    /* Checks if a key of another type is present, as for search(). */
+    template <typename K, typename = typename heterogeneous_key<K>::type>
+    bool count(const K& key) {
+        return (search_key(key) != -1);
+    }
+
+    /* Iterators over all key-value pairs, in no particular order. */
+    iterator begin() {
+        return iterator(&buckets, 0);
+    }
+
+    iterator end() {
+        return iterator(&buckets, buckets.num_buckets());
     }
 
     /* Returns the total number of key-value pairs. */
@@ -286,6 +996,21 @@ class ExtendibleHashTable {
         return num_keys;
     }
 
+    /* Returns the current global depth. */
+    size_t get_global_depth() {
+        return global_depth;
+    }
+
+    /* Returns the number of buckets. */
+    size_t get_num_buckets() {
+        return buckets.num_live_buckets();
+    }
+
+    /* Returns the number of buckets the slab holds memory for, including free ones. */
+    size_t get_slab_capacity() {
+        return buckets.capacity();
+    }
+
 	/* Print the hash table. */
 	void print(bool print_dir = false) {
         if(print_dir){
@@ -293,17 +1018,20 @@ class ExtendibleHashTable {
         }
 
         std::cout << "Global Depth: " << global_depth << "\n";
-		for(size_t i = 0; i < buckets.size(); ++i){
-			std::cout << "Bucket " << i << " (Local Depth " << buckets[i].local_depth << ") : ";
-			buckets[i].print();
+		for(size_t i = 0; i < buckets.num_buckets(); ++i){
+            if(buckets.isFree(i)){
+                continue;
+            }
+			std::cout << "Bucket " << i << " (Local Depth " << buckets.local_depths[i] << ") : ";
+			buckets.print(i);
 		}
 	}
 
     /* Print the hash table directory. */
     void print_directory(){
         std::cout << "Directory:" << "\n";
-		for(size_t i = 0; i < directory.size(); ++i){
-			std::cout << "dir[" << i << "] = " << directory[i] << "\n";
+		for(size_t i = 0; i < directory_size; ++i){
+			std::cout << "dir[" << i << "] = " << directory_entry(i) << "\n";
 		}
 	}
 };
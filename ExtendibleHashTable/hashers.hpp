@@ -0,0 +1,81 @@
+/*
+    Hash functions for the extendible hash tables.
+    Author: Ameya Daigavane
+*/
+
+#ifndef EXTENDIBLE_HASHING_HASHERS_HPP
+#define EXTENDIBLE_HASHING_HASHERS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+/* The 64-bit finalizer of MurmurHash3: every input bit affects every output bit. */
+inline uint64_t mix64(uint64_t x){
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+    Default hasher: std::hash, passed through mix64.
+    std::hash is the identity for integers, which sends keys sharing their low bits (such as aligned
+    addresses or ids) to the same bucket, however far the directory grows.
+*/
+template <typename KEY>
+struct MixHash {
+    size_t operator()(const KEY& key) const {
+        return (size_t) mix64((uint64_t) std::hash<KEY>()(key));
+    }
+};
+
+/*
+    Transparent default hasher for std::string keys: also hashes std::string_view (C++17) and C strings, equal
+    strings hashing alike, so tables can look strings up without building a std::string.
+*/
+template <>
+struct MixHash<std::string> {
+    typedef void is_transparent;
+
+#if __cplusplus >= 201703L
+    /* std::hash of a string_view equals that of the equal string. Covers std::string and C strings too. */
+    size_t operator()(std::string_view key) const {
+        return (size_t) mix64((uint64_t) std::hash<std::string_view>()(key));
+    }
+#else
+    size_t operator()(const std::string& key) const {
+        return (size_t) mix64((uint64_t) std::hash<std::string>()(key));
+    }
+
+    /* Without std::string_view, C strings are still hashed through a temporary std::string. */
+    size_t operator()(const char* key) const {
+        return (*this)(std::string(key));
+    }
+#endif
+};
+
+/* True if Hasher declares is_transparent, that is, it hashes types other than the key type consistently. */
+template <typename Hasher, typename = void>
+struct is_transparent_hasher : std::false_type {};
+
+template <typename Hasher>
+struct is_transparent_hasher<Hasher, typename std::conditional<true, void, typename Hasher::is_transparent>::type>
+    : std::true_type {};
+
+/* The identity hash, for integral keys. */
+template <typename KEY>
+struct IdentityHash {
+    size_t operator()(const KEY& key) const {
+        return (size_t) key;
+    }
+};
+
+#endif
@@ -0,0 +1,586 @@
+/*
+    Persistent Extendible Hashing in C++.
+    Author: Ameya Daigavane
+
+    A file-backed variant of ExtendibleHashTable, for trivially copyable keys and values, on POSIX systems.
+    Buckets are fixed-size pages of a memory-mapped file, and the directory is a second mapped file.
+    Reopening a table maps the files back in, without rebuilding anything.
+    Hasher must return the same values in every process opening the table: the default MixHash does
+    for integral keys.
+
+    Structural changes are ordered so that a crash at any point leaves a recoverable table:
+    - Doubling the directory writes the new upper half first, and only then bumps global_depth.
+    - Splitting a bucket is copy-on-write: both halves are written to fresh pages, which are recorded
+      in the file header before any directory entry points at them. Until every entry is updated,
+      the old page still holds all of its keys, and reopening finishes the split.
+    - Inserts and removes record the page they are modifying in the file header, so that reopening
+      after a crash only needs to check that page.
+*/
+
+#include <string>
+#include <cassert>
+#include <cstdint>
+#include <atomic>
+#include <functional>
+#include "hashers.hpp"
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Identifies a persistent extendible hash table file. */
+const uint64_t persistent_table_magic = 0x4548545045525354ull;
+
+/* Bytes reserved for the file header, before the first page. */
+const size_t persistent_header_size = 4096;
+
+/* Layout of the file header. */
+struct PersistentTableHeader {
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t val_size;
+    uint64_t num_slots;
+    uint64_t page_size;
+
+    /* Pages carved out of the file so far. Page ids start at 1, so 0 means none. */
+    uint64_t num_pages;
+    uint64_t free_head;
+
+    uint64_t global_depth;
+    uint64_t num_keys;
+
+    /* 1 if the table was closed cleanly. */
+    uint64_t clean;
+
+    /* Page being modified by an insert or remove, or 0. */
+    uint64_t pending_page;
+
+    /* Split in progress: the old page, and the pages taking its low and high halves. */
+    uint64_t split_active;
+    uint64_t split_old;
+    uint64_t split_low;
+    uint64_t split_high;
+};
+
+/* Layout of the start of every page. The keys and values follow at fixed offsets. */
+struct PersistentPageHeader {
+
+    /* local_depth in the upper 32 bits, number of keys in the lower 32 bits, so both change in one store. */
+    uint64_t meta;
+    uint64_t pattern;
+    uint64_t next_free;
+};
+
+template <typename KEY, typename VAL, typename Hasher = MixHash<KEY>>
+class PersistentExtendibleHashTable {
+
+    static_assert(std::is_trivially_copyable<KEY>::value && std::is_trivially_copyable<VAL>::value,
+                  "PersistentExtendibleHashTable needs trivially copyable keys and values.");
+
+    std::string path;
+    int pages_fd;
+    int dir_fd;
+    char* pages_map;
+    size_t pages_length;
+    uint64_t* directory;
+    size_t dir_length;
+    bool durable;
+
+    size_t num_slots;
+    size_t page_size;
+    size_t keys_offset;
+    size_t vals_offset;
+    Hasher hasher;
+    std::function<size_t (KEY)> hash_func;
+
+    PersistentTableHeader* header(){
+        return reinterpret_cast<PersistentTableHeader*>(pages_map);
+    }
+
+    PersistentPageHeader* page(uint64_t id){
+        return reinterpret_cast<PersistentPageHeader*>(pages_map + persistent_header_size + (id - 1) * page_size);
+    }
+
+    KEY* page_keys(uint64_t id){
+        return reinterpret_cast<KEY*>(reinterpret_cast<char*>(page(id)) + keys_offset);
+    }
+
+    VAL* page_vals(uint64_t id){
+        return reinterpret_cast<VAL*>(reinterpret_cast<char*>(page(id)) + vals_offset);
+    }
+
+    static uint64_t make_meta(size_t local_depth, size_t size){
+        return ((uint64_t) local_depth << 32) | size;
+    }
+
+    size_t page_depth(uint64_t id){
+        return page(id) -> meta >> 32;
+    }
+
+    size_t page_size_of(uint64_t id){
+        return page(id) -> meta & 0xffffffffull;
+    }
+
+    /* Publish a page's new depth and size in one store, after the slots it covers are written. */
+    void set_meta(uint64_t id, size_t local_depth, size_t size){
+        std::atomic_thread_fence(std::memory_order_release);
+        page(id) -> meta = make_meta(local_depth, size);
+    }
+
+    /* Main hash function used: Hasher, unless a hash function was set with set_hash(). */
+    size_t hash(const KEY& key) {
+        if(hash_func){
+            return hash_func(key);
+        }
+        return hasher(key);
+    }
+
+    /* Map length bytes of a file, growing the file if needed. */
+    static void* map_file(int fd, size_t length){
+        if(ftruncate(fd, length) != 0){
+            throw std::runtime_error("Cannot resize table file.");
+        }
+        void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED){
+            throw std::runtime_error("Cannot map table file.");
+        }
+        return map;
+    }
+
+    /* Flush a range of a mapping to disk, in durable mode. */
+    void flush(void* start, size_t length){
+        if(!durable){
+            return;
+        }
+
+        /* msync needs a page-aligned start. */
+        uintptr_t system_page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(start) & ~(system_page - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(start) + length;
+        msync(reinterpret_cast<void*>(begin), end - begin, MS_SYNC);
+    }
+
+    void flush_header(){
+        flush(header(), sizeof(PersistentTableHeader));
+    }
+
+    /* Make sure the pages file can hold num_pages pages, growing it geometrically. */
+    void reserve_pages(size_t num_pages){
+        size_t needed = persistent_header_size + num_pages * page_size;
+        if(needed <= pages_length){
+            return;
+        }
+
+        size_t length = pages_length * 2;
+        while(length < needed){
+            length *= 2;
+        }
+        munmap(pages_map, pages_length);
+        pages_map = static_cast<char*>(map_file(pages_fd, length));
+        pages_length = length;
+    }
+
+    /* Make sure the directory file can hold this many entries. */
+    void reserve_directory(size_t entries){
+        size_t needed = entries * sizeof(uint64_t);
+        if(needed <= dir_length){
+            return;
+        }
+
+        munmap(directory, dir_length);
+        directory = static_cast<uint64_t*>(map_file(dir_fd, needed));
+        dir_length = needed;
+    }
+
+    /* Take a page off the free list, or carve a new one out of the file. Crashing right after this only leaks the page. */
+    uint64_t allocate_page(){
+        uint64_t id = header() -> free_head;
+        if(id != 0){
+            header() -> free_head = page(id) -> next_free;
+        } else {
+            reserve_pages(header() -> num_pages + 1);
+            header() -> num_pages += 1;
+            id = header() -> num_pages;
+        }
+        return id;
+    }
+
+    /* Write an empty page. */
+    void init_page(uint64_t id, size_t local_depth, size_t pattern){
+        page(id) -> pattern = pattern;
+        page(id) -> next_free = 0;
+        page(id) -> meta = make_meta(local_depth, 0);
+    }
+
+    /* Returns the slot holding key in page id, or num_slots if the key is absent. */
+    size_t find_slot(uint64_t id, const KEY& key){
+        KEY* keys = page_keys(id);
+        size_t size = page_size_of(id);
+        for(size_t i = 0; i < size; ++i){
+            if(keys[i] == key){
+                return i;
+            }
+        }
+        return num_slots;
+    }
+
+    /* Double directory, and increase global depth by 1. The new half is written before it becomes visible. */
+    void double_directory() {
+        size_t curr_size = (size_t) 1 << header() -> global_depth;
+        reserve_directory(curr_size * 2);
+
+        for(size_t i = 0; i < curr_size; ++i){
+            directory[i + curr_size] = directory[i];
+        }
+        flush(directory + curr_size, curr_size * sizeof(uint64_t));
+
+        std::atomic_thread_fence(std::memory_order_release);
+        header() -> global_depth += 1;
+        flush_header();
+    }
+
+    /* Split the page at directory index into two fresh pages. */
+    void split_bucket(size_t index) {
+        uint64_t old_id = directory[index];
+        size_t local_depth = page_depth(old_id);
+        size_t mask = (size_t) 1 << local_depth;
+        size_t pattern = page(old_id) -> pattern;
+
+        uint64_t low_id = allocate_page();
+        uint64_t high_id = allocate_page();
+        init_page(low_id, local_depth + 1, pattern);
+        init_page(high_id, local_depth + 1, pattern | mask);
+
+        /* Rehash values for this split bucket, copying into the new pages. */
+        size_t size = page_size_of(old_id);
+        size_t low_size = 0;
+        size_t high_size = 0;
+        for(size_t i = 0; i < size; ++i){
+            KEY key = page_keys(old_id)[i];
+            if(hash(key) & mask){
+                page_keys(high_id)[high_size] = key;
+                page_vals(high_id)[high_size] = page_vals(old_id)[i];
+                high_size += 1;
+            } else {
+                page_keys(low_id)[low_size] = key;
+                page_vals(low_id)[low_size] = page_vals(old_id)[i];
+                low_size += 1;
+            }
+        }
+        set_meta(low_id, local_depth + 1, low_size);
+        set_meta(high_id, local_depth + 1, high_size);
+        flush(page(low_id), page_size);
+        flush(page(high_id), page_size);
+
+        /* Record the split, and only then make it visible. */
+        header() -> split_old = old_id;
+        header() -> split_low = low_id;
+        header() -> split_high = high_id;
+        std::atomic_thread_fence(std::memory_order_release);
+        header() -> split_active = 1;
+        flush_header();
+
+        finish_split();
+    }
+
+    /* Point the directory at the pages of the recorded split, and free the old page. Safe to repeat. */
+    void finish_split() {
+        PersistentTableHeader* h = header();
+        uint64_t old_id = h -> split_old;
+        size_t local_depth = page_depth(h -> split_low) - 1;
+        size_t mask = (size_t) 1 << local_depth;
+        size_t dir_size = (size_t) 1 << h -> global_depth;
+
+        /* Point to correct buckets. */
+        for(size_t i = page(h -> split_low) -> pattern; i < dir_size; i += mask){
+            directory[i] = (i & mask) ? h -> split_high : h -> split_low;
+        }
+        flush(directory, dir_size * sizeof(uint64_t));
+
+        if(h -> free_head != old_id){
+            page(old_id) -> next_free = h -> free_head;
+            std::atomic_thread_fence(std::memory_order_release);
+            h -> free_head = old_id;
+        }
+
+        std::atomic_thread_fence(std::memory_order_release);
+        h -> split_active = 0;
+        flush_header();
+    }
+
+    /* Bring a table that was not closed cleanly back to a consistent state. */
+    void recover() {
+        PersistentTableHeader* h = header();
+
+        if(h -> split_active){
+            finish_split();
+        }
+
+        /*
+            A remove may have left the moved key in two slots of the pending page, and maybe not its value yet:
+            the value is copied along again before the last slot is dropped.
+        */
+        uint64_t id = h -> pending_page;
+        if(id != 0){
+            size_t size = page_size_of(id);
+            if(size > 0){
+                KEY* keys = page_keys(id);
+                for(size_t i = 0; i + 1 < size; ++i){
+                    if(keys[i] == keys[size - 1]){
+                        page_vals(id)[i] = page_vals(id)[size - 1];
+                        set_meta(id, page_depth(id), size - 1);
+                        break;
+                    }
+                }
+            }
+            h -> pending_page = 0;
+        }
+
+        /* Recount the keys, visiting every page through the first directory entry pointing at it. */
+        size_t dir_size = (size_t) 1 << h -> global_depth;
+        uint64_t total = 0;
+        for(size_t i = 0; i < dir_size; ++i){
+            uint64_t page_id = directory[i];
+            if(page(page_id) -> pattern == i){
+                total += page_size_of(page_id);
+            }
+        }
+        h -> num_keys = total;
+    }
+
+    /* Mark a page as being modified, until end_page_write(). */
+    void begin_page_write(uint64_t id){
+        header() -> pending_page = id;
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_page_write(){
+        std::atomic_thread_fence(std::memory_order_release);
+        header() -> pending_page = 0;
+    }
+
+    /* Map the files of an existing table and check them, or lay out a new table. The caller closes the files if this throws. */
+    void open_table(size_t global_depth){
+        struct stat info;
+        if(fstat(pages_fd, &info) != 0){
+            throw std::runtime_error("Cannot read the size of the table files at " + path + ".");
+        }
+        bool exists = info.st_size > 0;
+
+        if(exists){
+            pages_length = info.st_size;
+            pages_map = static_cast<char*>(map_file(pages_fd, pages_length));
+
+            PersistentTableHeader* h = header();
+            if(h -> magic != persistent_table_magic || h -> key_size != sizeof(KEY) || h -> val_size != sizeof(VAL)){
+                throw std::runtime_error("Table file at " + path + " does not match the key and value types.");
+            }
+
+            /* The layout is fixed when the table is created. */
+            this -> num_slots = h -> num_slots;
+            page_size = h -> page_size;
+            vals_offset = keys_offset + this -> num_slots * sizeof(KEY);
+            vals_offset = (vals_offset + alignof(VAL) - 1) / alignof(VAL) * alignof(VAL);
+
+            if(fstat(dir_fd, &info) != 0){
+                throw std::runtime_error("Cannot read the size of the table files at " + path + ".");
+            }
+            dir_length = info.st_size;
+            directory = static_cast<uint64_t*>(map_file(dir_fd, dir_length));
+
+            if(!h -> clean){
+                recover();
+            }
+        } else {
+            pages_length = persistent_header_size + ((size_t) 1 << global_depth) * page_size;
+            pages_map = static_cast<char*>(map_file(pages_fd, pages_length));
+            dir_length = ((size_t) 1 << global_depth) * sizeof(uint64_t);
+            directory = static_cast<uint64_t*>(map_file(dir_fd, dir_length));
+
+            header() -> key_size = sizeof(KEY);
+            header() -> val_size = sizeof(VAL);
+            header() -> num_slots = num_slots;
+            header() -> page_size = page_size;
+            header() -> global_depth = global_depth;
+
+            for(size_t i = 0; i < ((size_t) 1 << global_depth); ++i){
+                uint64_t id = allocate_page();
+                init_page(id, global_depth, i);
+                directory[i] = id;
+            }
+            sync();
+
+            /* The magic number goes in last, so that a half-created table is never opened. */
+            header() -> magic = persistent_table_magic;
+        }
+    }
+
+    /* Unmap and close whatever was mapped and opened. */
+    void close_files(){
+        if(pages_map != NULL){
+            munmap(pages_map, pages_length);
+        }
+        if(directory != NULL){
+            munmap(directory, dir_length);
+        }
+        if(pages_fd >= 0){
+            close(pages_fd);
+        }
+        if(dir_fd >= 0){
+            close(dir_fd);
+        }
+    }
+
+    public:
+    /*
+        Opens the table stored at path (as path + ".pages" and path + ".dir"), creating it if it does not exist.
+        num_slots = 0 fits as many slots as possible into 4 KiB pages.
+        When durable is true, structural changes are flushed to disk in order, so that the table also
+        survives power loss; otherwise it survives crashes of the process.
+    */
+    PersistentExtendibleHashTable(const std::string& path, size_t global_depth = 0, size_t num_slots = 0, bool durable = false) {
+        this -> path = path;
+        this -> durable = durable;
+
+        if(num_slots == 0){
+            num_slots = (4096 - sizeof(PersistentPageHeader)) / (sizeof(KEY) + sizeof(VAL));
+        }
+
+        /* Keys follow the page header, values follow the keys, each aligned for its type. */
+        this -> num_slots = num_slots;
+        keys_offset = sizeof(PersistentPageHeader);
+        vals_offset = keys_offset + num_slots * sizeof(KEY);
+        vals_offset = (vals_offset + alignof(VAL) - 1) / alignof(VAL) * alignof(VAL);
+        page_size = vals_offset + num_slots * sizeof(VAL);
+        page_size = (page_size + 63) / 64 * 64;
+
+        pages_map = NULL;
+        directory = NULL;
+        pages_fd = open((path + ".pages").c_str(), O_RDWR | O_CREAT, 0644);
+        dir_fd = open((path + ".dir").c_str(), O_RDWR | O_CREAT, 0644);
+        try {
+            if(pages_fd < 0 || dir_fd < 0){
+                throw std::runtime_error("Cannot open table files at " + path + ".");
+            }
+            open_table(global_depth);
+        } catch(...){
+            close_files();
+            throw;
+        }
+
+        header() -> clean = 0;
+        flush_header();
+    }
+
+    /* Flushes everything and marks the table as closed cleanly. */
+    ~PersistentExtendibleHashTable() {
+        sync();
+        header() -> clean = 1;
+        msync(pages_map, persistent_header_size, MS_SYNC);
+
+        close_files();
+    }
+
+    PersistentExtendibleHashTable(const PersistentExtendibleHashTable&) = delete;
+    PersistentExtendibleHashTable& operator=(const PersistentExtendibleHashTable&) = delete;
+
+    /* Sets the hash function. It must be set to the same function every time the table is opened, like Hasher. */
+    void set_hash(const std::function<size_t (KEY)>& func) {
+        hash_func = func;
+    }
+
+    /* Flushes all changes to disk. */
+    void sync() {
+        msync(pages_map, pages_length, MS_SYNC);
+        msync(directory, dir_length, MS_SYNC);
+    }
+
+    /* Get bucket index corresponding to this key. */
+    size_t get_bucket_index(KEY key) {
+        return hash(key) & (((size_t) 1 << header() -> global_depth) - 1);
+    }
+
+    /* Insert into the hash table, overwriting the value if the key is already present. */
+    void insert(KEY key, VAL val) {
+        size_t index = get_bucket_index(key);
+        uint64_t id = directory[index];
+        size_t slot = find_slot(id, key);
+
+        if(slot != num_slots){
+            begin_page_write(id);
+            page_vals(id)[slot] = val;
+            end_page_write();
+            return;
+        }
+
+        /* Check if the bucket is full. */
+        size_t size = page_size_of(id);
+        if(size == num_slots){
+
+            /* If the bucket's local depth matches the global depth, then we have to double the directory first. */
+            if(page_depth(id) == header() -> global_depth){
+                double_directory();
+            }
+
+            /* Split only this bucket, and try inserting again. */
+            split_bucket(index);
+            insert(key, val);
+            return;
+        }
+
+        begin_page_write(id);
+        page_keys(id)[size] = key;
+        page_vals(id)[size] = val;
+        set_meta(id, page_depth(id), size + 1);
+        header() -> num_keys += 1;
+        end_page_write();
+    }
+
+    /* Searches for the key in the hash table. Returns true and sets val if the key is present. */
+    bool find(KEY key, VAL& val) {
+        uint64_t id = directory[get_bucket_index(key)];
+        size_t slot = find_slot(id, key);
+
+        if(slot == num_slots){
+            return false;
+        }
+        val = page_vals(id)[slot];
+        return true;
+    }
+
+    /* Checks if key is present in the hash table. */
+    bool count(KEY key) {
+        return find_slot(directory[get_bucket_index(key)], key) != num_slots;
+    }
+
+    /* Delete a key from the hash table. */
+    void remove(KEY key) {
+        uint64_t id = directory[get_bucket_index(key)];
+        size_t slot = find_slot(id, key);
+
+        /* Key must be present in the hash table. */
+        assert(slot != num_slots);
+
+        /* Move the last key into the hole, then drop the last slot. */
+        begin_page_write(id);
+        size_t last = page_size_of(id) - 1;
+        page_keys(id)[slot] = page_keys(id)[last];
+        page_vals(id)[slot] = page_vals(id)[last];
+        set_meta(id, page_depth(id), last);
+        header() -> num_keys -= 1;
+        end_page_write();
+    }
+
+    /* Returns the total number of key-value pairs. */
+    size_t size() {
+        return header() -> num_keys;
+    }
+
+    /* Returns the current global depth. */
+    size_t get_global_depth() {
+        return header() -> global_depth;
+    }
+};
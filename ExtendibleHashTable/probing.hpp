@@ -0,0 +1,68 @@
+/*
+    Fingerprint probing helpers, shared by the hash tables.
+    Author: Ameya Daigavane
+*/
+
+#ifndef HASH_TABLE_PROBING_HPP
+#define HASH_TABLE_PROBING_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Number of fingerprints compared at once when probing a bucket. */
+#if defined(__AVX2__)
+const size_t tag_group_width = 32;
+#else
+const size_t tag_group_width = 16;
+#endif
+
+/* One-byte fingerprint of a hash value. Mixes all bits in, since the low bits already pick the bucket. */
+inline uint8_t hash_tag(size_t hash_val){
+    return (uint8_t) (((uint64_t) hash_val * 0x9E3779B97F4A7C15ull) >> 56);
+}
+
+/* Bitmask of the tag_group_width fingerprints starting at tags which are equal to tag. */
+inline uint32_t match_tag_group(const uint8_t* tags, uint8_t tag){
+#if defined(__AVX2__)
+    __m256i group = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags));
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8((char) tag)));
+#elif defined(__SSE2__)
+    __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tags));
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) tag)));
+#else
+    uint32_t mask = 0;
+    for(size_t i = 0; i < tag_group_width; ++i){
+        mask |= (uint32_t) (tags[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Hint the processor to start loading the cache line at addr. */
+inline void prefetch(const void* addr){
+#if defined(__GNUC__)
+    __builtin_prefetch(addr);
+#elif defined(__SSE2__)
+    _mm_prefetch(static_cast<const char*>(addr), _MM_HINT_T0);
+#endif
+}
+
+/* Index of the lowest set bit of a nonzero mask. */
+inline size_t lowest_bit(uint32_t mask){
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    size_t i = 0;
+    while(!(mask & 1)){
+        mask >>= 1;
+        i += 1;
+    }
+    return i;
+#endif
+}
+
+#endif
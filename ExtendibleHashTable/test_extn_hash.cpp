@@ -6,7 +6,24 @@
 #include <iostream>
 #include <cstdlib>
 #include <cassert>
+#include <string>
+#include <vector>
+#include <set>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include "extendible_hashing.hpp"
+#include "concurrent_extendible_hashing.hpp"
+#include "persistent_extendible_hashing.hpp"
 
 /* Custom hash for the hashtable. */
 size_t custom_hash(int x){
@@ -28,10 +45,12 @@ int main(){
     eht.print();
     std::cout << "\n";
 
-    /* Insert random keys. */
+    /* Insert random keys, remembering them for the checks below. */
     int num_keys = 1000;
+    std::vector<int> keys;
     for(int i = 0; i < num_keys; ++i){
-        eht.insert(rand() % 100000, rand() % 10);
+        keys.push_back(rand() % 100000);
+        eht.insert(keys.back(), rand() % 10);
     }
 
     eht.print();
@@ -40,20 +59,478 @@ int main(){
     std::cout << "Insertion tests passed!" << "\n";
 
     /* Search some keys. */
-    assert(eht.count(0) == false);
-    assert(eht.count(27432) == true);
-    assert(eht.count(1) == false);
-    assert(eht.count(4860) == true);
+    assert(eht.count(-1) == false);
+    assert(eht.count(keys[0]) == true);
+    assert(eht.count(100000) == false);
+    assert(eht.count(keys[num_keys - 1]) == true);
+
+    for(int i = 0; i < num_keys; ++i){
+        assert(eht.count(keys[i]) == true);
+    }
 
     std::cout << "Search tests passed!" << "\n";
 
     /* Delete some keys. */
-    eht.remove(4860);
-    assert(eht.count(4860) == false);
+    eht.remove(keys[0]);
+    assert(eht.count(keys[0]) == false);
 
-    eht.remove(27432);
-    assert(eht.count(27432) == false);
+    eht.remove(keys[num_keys - 1]);
+    assert(eht.count(keys[num_keys - 1]) == false);
 
     std::cout << "Deletion tests passed!" << "\n";
+
+    /* Buckets live in one slab: every key must survive many splits, and deletes must keep the count exact. */
+    ExtendibleHashTable<int, std::string> flat(0, 16);
+    for(int i = 0; i < 5000; ++i){
+        flat.insert(i * 7, std::to_string(i));
+    }
+    assert(flat.size() == 5000);
+
+    for(int i = 0; i < 5000; i += 2){
+        flat.remove(i * 7);
+    }
+    assert(flat.size() == 2500);
+
+    for(int i = 0; i < 5000; ++i){
+        assert(flat.count(i * 7) == (i % 2 == 1));
+    }
+
+    std::cout << "Flat layout tests passed!" << "\n";
+
+    /* Wide buckets are probed by fingerprint groups; sizes which are not a multiple of the group width must work too. */
+    int wide_slots[] = {20, 64};
+    for(int w = 0; w < 2; ++w){
+        ExtendibleHashTable<long long, int> wide(0, wide_slots[w]);
+        for(int i = 0; i < 3000; ++i){
+            wide.insert((long long) i * 1000003, i);
+        }
+        for(int i = 0; i < 3000; ++i){
+            assert(wide.count((long long) i * 1000003) == true);
+            assert(wide.count(((long long) i * 1000003) + 1) == false);
+        }
+        for(int i = 0; i < 3000; i += 3){
+            wide.remove((long long) i * 1000003);
+        }
+        for(int i = 0; i < 3000; ++i){
+            assert(wide.count((long long) i * 1000003) == (i % 3 != 0));
+        }
+        assert(wide.size() == 2000);
+    }
+
+    std::cout << "Fingerprint probing tests passed!" << "\n";
+
+    /* Copy one directory entry per operation, so that splits and doublings happen while doublings are in progress. */
+    ExtendibleHashTable<int, int> incremental(0, 2);
+    incremental.set_migration_chunk(1);
+    for(int i = 0; i < 20000; ++i){
+        incremental.insert(i * 13, i);
+        assert(incremental.count((i / 2) * 13) == true);
+    }
+    for(int i = 0; i < 20000; ++i){
+        assert(incremental.count(i * 13) == true);
+        assert(incremental.count(i * 13 + 1) == false);
+    }
+    for(int i = 0; i < 20000; i += 4){
+        incremental.remove(i * 13);
+    }
+    assert(incremental.size() == 15000);
+
+    /* Keys sharing their low hash bits double the directory several times within one insert, so doublings pile up unfinished. */
+    ExtendibleHashTable<size_t, int, IdentityHash<size_t>> skewed(0, 2);
+    skewed.set_migration_chunk(1);
+    std::set<size_t> skewed_keys;
+    for(size_t i = 0; i < 3000; ++i){
+        size_t keys[] = {(i % 3) << (i % 20), i * 7919};
+        for(int k = 0; k < 2; ++k){
+            skewed.insert(keys[k], (int) i);
+            skewed_keys.insert(keys[k]);
+        }
+        if(i % 3 == 0 && skewed_keys.count(i * 13)){
+            skewed.remove(i * 13);
+            skewed_keys.erase(i * 13);
+        }
+    }
+    for(size_t i = 0; i < 3000 * 7919; i += 13){
+        assert(skewed.count(i) == (skewed_keys.count(i) == 1));
+    }
+    for(std::set<size_t>::iterator it = skewed_keys.begin(); it != skewed_keys.end(); ++it){
+        assert(skewed.count(*it) == true);
+    }
+    assert(skewed.size() == skewed_keys.size());
+
+    std::cout << "Incremental doubling tests passed!" << "\n";
+
+    /* Batch inserts and lookups must agree with one-at-a-time ones, including across batch window boundaries. */
+    ExtendibleHashTable<int, int> batched(0, 8);
+    std::vector<std::pair<int, int>> pairs;
+    for(int i = 0; i < 10007; ++i){
+        pairs.push_back(std::make_pair(i * 31, i));
+    }
+    batched.insert_batch(pairs.begin(), pairs.end());
+    assert(batched.size() == 10007);
+
+    std::vector<int> lookups;
+    for(int i = 0; i < 20011; ++i){
+        lookups.push_back(i * 31);
+    }
+    std::vector<int*> found;
+    batched.find_batch(lookups, found);
+    assert(found.size() == lookups.size());
+    for(int i = 0; i < 20011; ++i){
+        assert((found[i] != NULL) == (i < 10007));
+        assert(i >= 10007 || *found[i] == i);
+    }
+
+    std::cout << "Batch tests passed!" << "\n";
+
+    /* The default hasher must spread keys that share their low bits, and must work for strings. */
+    ExtendibleHashTable<long long, int> aligned(0, 4);
+    for(int i = 0; i < 4096; ++i){
+        aligned.insert((long long) i << 12, i);
+    }
+    assert(aligned.get_global_depth() < 16);
+
+    ExtendibleHashTable<long long, int, IdentityHash<long long>> identity(0, 4);
+    for(int i = 0; i < 64; ++i){
+        identity.insert((long long) i << 12, i);
+    }
+    assert(identity.get_global_depth() >= 12);
+
+    ExtendibleHashTable<std::string, int> named;
+    for(int i = 0; i < 1000; ++i){
+        named.insert("key" + std::to_string(i), i);
+    }
+    for(int i = 0; i < 1000; ++i){
+        assert(named.count("key" + std::to_string(i)) == true);
+    }
+    assert(named.count("key1000") == false);
+
+    std::cout << "Hasher tests passed!" << "\n";
+
+    /* String keys can be looked up without building a std::string, and move-only values can be moved in. */
+    assert(named.count("key999") == true);
+    assert(named.search("key1000") == -1);
+    const char* c_key = "key0";
+    assert(named.count(c_key) == true);
+#if __cplusplus >= 201703L
+    std::string buffer = "key5 and some text after it";
+    assert(named.count(std::string_view(buffer).substr(0, 4)) == true);
+    named.remove(std::string_view(buffer).substr(0, 4));
+    assert(named.count("key5") == false);
+#endif
+
+    ExtendibleHashTable<std::string, std::unique_ptr<int>> owners(0, 4);
+    for(int i = 0; i < 1000; ++i){
+        owners.insert("owner" + std::to_string(i), std::unique_ptr<int>(new int(i)));
+    }
+    for(int i = 0; i < 1000; i += 2){
+        owners.emplace("owner" + std::to_string(i), new int(-i));
+    }
+    for(int i = 0; i < 1000; i += 3){
+        owners.remove("owner" + std::to_string(i));
+    }
+
+    /* A key passed as an lvalue is copied, while the value beside it is moved in. */
+    std::string kept_key = "kept";
+    std::unique_ptr<int> kept_val(new int(7));
+    owners.insert(kept_key, std::move(kept_val));
+    assert(kept_key == "kept" && !kept_val && owners.count("kept") == true);
+    std::vector<std::string> owner_keys;
+    for(int i = 0; i < 1000; ++i){
+        owner_keys.push_back("owner" + std::to_string(i));
+    }
+    std::vector<std::unique_ptr<int>*> owned;
+    owners.find_batch(owner_keys, owned);
+    for(int i = 0; i < 1000; ++i){
+        assert((owned[i] != NULL) == (i % 3 != 0));
+        assert(i % 3 == 0 || **owned[i] == (i % 2 == 0 ? -i : i));
+    }
+
+    /* Removed values are released at once, including those moved around by splits and merges. */
+    std::shared_ptr<int> shared(new int(7));
+    ExtendibleHashTable<int, std::shared_ptr<int>> sharers(0, 4);
+    sharers.insert(18, shared);
+    sharers.insert(19, shared);
+    sharers.remove(19);
+    sharers.remove(18);
+    assert(shared.use_count() == 1);
+    for(int i = 0; i < 1000; ++i){
+        sharers.insert(i, shared);
+    }
+    for(int i = 0; i < 1000; ++i){
+        sharers.remove(i);
+    }
+    assert(shared.use_count() == 1);
+
+    std::cout << "Heterogeneous lookup tests passed!" << "\n";
+
+    /* Values are read and updated in place through find(), operator[] and try_emplace(). */
+    ExtendibleHashTable<int, std::string> lookup(0, 4);
+    for(int i = 0; i < 2000; ++i){
+        lookup[i * 5] = std::to_string(i);
+    }
+    for(int i = 0; i < 4000; ++i){
+        std::string* val = lookup.find(i * 5);
+        assert((val != NULL) == (i < 2000));
+        assert(i >= 2000 || *val == std::to_string(i));
+    }
+    lookup[0] += "!";
+    assert(*lookup.find(0) == "0!");
+    assert(lookup[1].empty() == true);
+    assert(lookup.size() == 2001);
+
+    std::pair<std::string*, bool> tried = lookup.try_emplace(5, "new");
+    assert(tried.second == false && *tried.first == "1");
+    tried = lookup.try_emplace(2, 3, 'x');
+    assert(tried.second == true && *tried.first == "xxx");
+    lookup.remove(1);
+    lookup.remove(2);
+
+    /* Iteration visits every pair exactly once, though directory entries alias buckets. */
+    std::vector<int> seen(2000, 0);
+    size_t visited = 0;
+    for(ExtendibleHashTable<int, std::string>::iterator it = lookup.begin(); it != lookup.end(); ++it){
+        assert(it.key() % 5 == 0 && it.value().substr(0, std::to_string(it.key() / 5).size()) == std::to_string(it.key() / 5));
+        seen[it.key() / 5] += 1;
+        visited += 1;
+    }
+    assert(visited == lookup.size());
+    for(int i = 0; i < 2000; ++i){
+        assert(seen[i] == 1);
+    }
+
+    /* Range-for gives pairs of references, through which values can be changed. */
+    for(auto pair : lookup){
+        pair.second = "v" + std::to_string(pair.first);
+    }
+    assert(*lookup.find(35) == "v35");
+
+    ExtendibleHashTable<int, int> empty_table;
+    assert(empty_table.begin() == empty_table.end());
+
+    std::cout << "Find and iteration tests passed!" << "\n";
+
+    /* After a burst, deletes must merge buckets and shrink the directory back, and the table must grow again. */
+    ExtendibleHashTable<int, int> burst(0, 8);
+    for(int i = 0; i < 50000; ++i){
+        burst.insert(i, i);
+    }
+    size_t peak_depth = burst.get_global_depth();
+    size_t peak_buckets = burst.get_num_buckets();
+    size_t peak_capacity = burst.get_slab_capacity();
+
+    for(int i = 0; i < 50000; ++i){
+        if(i % 1000 != 0){
+            burst.remove(i);
+        }
+    }
+    assert(burst.size() == 50);
+    assert(burst.get_global_depth() < peak_depth - 4);
+    assert(burst.get_num_buckets() < peak_buckets / 16);
+    assert(burst.get_slab_capacity() < peak_capacity / 16);
+    for(int i = 0; i < 50000; ++i){
+        assert(burst.count(i) == (i % 1000 == 0));
+    }
+
+    for(int i = 0; i < 50000; ++i){
+        burst.insert(i, i);
+    }
+    assert(burst.size() == 50000);
+    for(int i = 0; i < 50000; ++i){
+        assert(burst.count(i) == true);
+    }
+
+    std::cout << "Merging tests passed!" << "\n";
+
+    /* Writers on disjoint key ranges race with lock-free readers, and with each other's splits and doublings. */
+    ConcurrentExtendibleHashTable<int, int> ceht(0, 4);
+    int num_threads = 4;
+    int keys_per_thread = 5000;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&ceht, t, keys_per_thread](){
+            for(int i = 0; i < keys_per_thread; ++i){
+                int key = t * keys_per_thread + i;
+                ceht.insert(key, key * 2);
+
+                /* Keys inserted earlier by this thread must stay visible throughout. */
+                int val = 0;
+                int earlier = t * keys_per_thread + i / 2;
+                assert(ceht.find(earlier, val) == true);
+                assert(val == earlier * 2);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+    assert(ceht.size() == (size_t) (num_threads * keys_per_thread));
+
+    threads.clear();
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&ceht, t, keys_per_thread](){
+            for(int i = 0; i < keys_per_thread; i += 2){
+                assert(ceht.remove(t * keys_per_thread + i) == true);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    for(int key = 0; key < num_threads * keys_per_thread; ++key){
+        assert(ceht.count(key) == (key % 2 == 1));
+    }
+    assert(ceht.remove(0) == false);
+    assert(ceht.size() == (size_t) (num_threads * keys_per_thread / 2));
+
+    /* Lookups must finish, and find the key, while writers keep rewriting its bucket. */
+    ConcurrentExtendibleHashTable<int, int> hot(0, 4);
+    hot.insert(1, 1);
+    std::atomic<bool> writing(true);
+    threads.clear();
+    for(int t = 0; t < 2; ++t){
+        threads.push_back(std::thread([&hot, &writing, t](){
+            for(int i = 0; writing.load(); ++i){
+                hot.insert(1, i % 2 + 1);
+                hot.insert(2 + t, i);
+                hot.remove(2 + t);
+            }
+        }));
+    }
+    for(int i = 0; i < 100000; ++i){
+        int val = 0;
+        assert(hot.find(1, val) == true);
+        assert(val == 1 || val == 2);
+    }
+    writing.store(false);
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    std::cout << "Concurrency tests passed!" << "\n";
+
+    /* A file-backed table must come back intact after a clean close, and after its process dies mid-use. */
+    std::string table_path = "test_extn_hash.persistent";
+    std::remove((table_path + ".pages").c_str());
+    std::remove((table_path + ".dir").c_str());
+    {
+        PersistentExtendibleHashTable<int, long long> peht(table_path, 0, 8);
+        for(int i = 0; i < 10000; ++i){
+            peht.insert(i * 3, (long long) i * i);
+        }
+        for(int i = 0; i < 10000; i += 5){
+            peht.remove(i * 3);
+        }
+    }
+    {
+        PersistentExtendibleHashTable<int, long long> peht(table_path);
+        assert(peht.size() == 8000);
+        for(int i = 0; i < 10000; ++i){
+            long long val = 0;
+            assert(peht.find(i * 3, val) == (i % 5 != 0));
+            assert(i % 5 == 0 || val == (long long) i * i);
+        }
+    }
+
+    pid_t child = fork();
+    if(child == 0){
+        PersistentExtendibleHashTable<int, long long> peht(table_path);
+        for(int i = 10000; i < 30000; ++i){
+            peht.insert(i * 3, (long long) i * i);
+        }
+
+        /* Exit without closing the table. */
+        _exit(0);
+    }
+    waitpid(child, NULL, 0);
+    {
+        PersistentExtendibleHashTable<int, long long> peht(table_path);
+        assert(peht.size() == 28000);
+        for(int i = 0; i < 30000; ++i){
+            assert(peht.count(i * 3) == (i >= 10000 || i % 5 != 0));
+        }
+    }
+
+    /* Kill a writer at an arbitrary point: the keys it inserted must form a prefix of its insertion order. */
+    child = fork();
+    if(child == 0){
+        PersistentExtendibleHashTable<int, long long> peht(table_path);
+        for(int i = 30000; ; ++i){
+            peht.insert(i * 3, (long long) i * i);
+        }
+    }
+    usleep(50000);
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    {
+        PersistentExtendibleHashTable<int, long long> peht(table_path);
+        int end = 30000;
+        while(peht.count(end * 3)){
+            long long val = 0;
+            assert(peht.find(end * 3, val) && val == (long long) end * end);
+            end += 1;
+        }
+        for(int i = end; i < end + 1000; ++i){
+            assert(peht.count(i * 3) == false);
+        }
+        assert(peht.size() == (size_t) (28000 + end - 30000));
+    }
+
+    /*
+        A remove crashing after moving the last key into the hole, but before moving its value, leaves the key
+        twice in its page, once beside the removed key's value. Reopening must keep the key's own value.
+        The files of a closed table are patched into that state: remove(10) moving key 30 into slot 0.
+    */
+    std::string torn_path = "test_extn_hash.torn";
+    std::remove((torn_path + ".pages").c_str());
+    std::remove((torn_path + ".dir").c_str());
+    {
+        PersistentExtendibleHashTable<long long, long long> peht(torn_path, 0, 4);
+        peht.insert(10, 100);
+        peht.insert(20, 200);
+        peht.insert(30, 300);
+    }
+    {
+        int fd = open((torn_path + ".pages").c_str(), O_RDWR);
+        PersistentTableHeader h;
+        assert(pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h));
+        long long moved_key = 0;
+        off_t keys_at = persistent_header_size + sizeof(PersistentPageHeader);
+        assert(pread(fd, &moved_key, sizeof(moved_key), keys_at + 2 * sizeof(long long)) == (ssize_t) sizeof(moved_key));
+        assert(moved_key == 30);
+        assert(pwrite(fd, &moved_key, sizeof(moved_key), keys_at) == (ssize_t) sizeof(moved_key));
+        h.pending_page = 1;
+        h.clean = 0;
+        assert(pwrite(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h));
+        close(fd);
+    }
+    {
+        PersistentExtendibleHashTable<long long, long long> peht(torn_path);
+        long long val = 0;
+        assert(peht.size() == 2 && peht.count(10) == false);
+        assert(peht.find(20, val) && val == 200);
+        assert(peht.find(30, val) && val == 300);
+    }
+    std::remove((torn_path + ".pages").c_str());
+    std::remove((torn_path + ".dir").c_str());
+
+    /* Opening a table as other types fails, without leaking the files it opened and mapped. */
+    int first_free_fd = dup(0);
+    close(first_free_fd);
+    bool refused = false;
+    try {
+        PersistentExtendibleHashTable<int, int> peht(table_path);
+    } catch(const std::runtime_error&){
+        refused = true;
+    }
+    assert(refused);
+    int next_free_fd = dup(0);
+    close(next_free_fd);
+    assert(next_free_fd == first_free_fd);
+    std::remove((table_path + ".pages").c_str());
+    std::remove((table_path + ".dir").c_str());
+
+    std::cout << "Persistence tests passed!" << "\n";
     std::cout << "All tests passed!" << "\n";
 }
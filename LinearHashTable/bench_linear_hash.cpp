@@ -0,0 +1,163 @@
+/*
+	Benchmarks for linear_hashing.hpp, concurrent_linear_hashing.hpp and persistent_linear_hashing.hpp.
+    Author: Ameya Daigavane
+*/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include "linear_hashing.hpp"
+#include "concurrent_linear_hashing.hpp"
+#include "persistent_linear_hashing.hpp"
+
+/* Small xorshift generator, one per thread. */
+struct XorShift {
+    uint64_t state;
+
+    XorShift(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    uint64_t next(){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+/*
+    Run ops_per_thread operations on each of num_threads threads, and return the total throughput in Mops/s.
+    Each operation returns a number, which is summed so that the compiler cannot drop lookups whose results are unused.
+*/
+template <typename OP>
+double run_threads(int num_threads, int ops_per_thread, OP op){
+    std::vector<std::thread> threads;
+    std::atomic<size_t> checksum(0);
+    auto start = std::chrono::steady_clock::now();
+
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&op, &checksum, t, ops_per_thread](){
+            XorShift rng(t + 1);
+            size_t sum = 0;
+            for(int i = 0; i < ops_per_thread; ++i){
+                sum += op(rng);
+            }
+            checksum.fetch_add(sum);
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return num_threads * (double) ops_per_thread / elapsed.count() / 1e6;
+}
+
+/*
+    Mixed workload: 90% lookups, 5% inserts and 5% deletes over a preloaded key range, from 1 to 64 threads.
+    Inserts of new keys keep the split pointer moving throughout.
+*/
+void bench_concurrency(){
+    const int key_range = 1 << 20;
+    const int ops_per_thread = 200000;
+
+    std::cout << "Threads | global mutex (Mops/s) | concurrent (Mops/s)" << "\n";
+    for(int num_threads = 1; num_threads <= 64; num_threads *= 2){
+
+        LinearHashTable<int, int> lht(16, 8);
+        lht.set_max_load(0.8);
+        ConcurrentLinearHashTable<int, int> clht(16, 8, 0.8);
+        for(int key = 0; key < key_range; key += 2){
+            lht.insert(key, key);
+            clht.insert(key, key);
+        }
+
+        std::mutex global_mutex;
+        double locked = run_threads(num_threads, ops_per_thread, [&](XorShift& rng){
+            uint64_t r = rng.next();
+            int key = (int) (r % key_range);
+            int op = (int) ((r >> 32) % 20);
+            std::lock_guard<std::mutex> guard(global_mutex);
+            if(op == 0){
+                lht.insert(key, key);
+                return (size_t) 0;
+            }
+            if(op == 1){
+                if(lht.count(key)){
+                    lht.del(key);
+                }
+                return (size_t) 0;
+            }
+            return (size_t) lht.count(key);
+        });
+
+        double concurrent = run_threads(num_threads, ops_per_thread, [&](XorShift& rng){
+            uint64_t r = rng.next();
+            int key = (int) (r % key_range);
+            int op = (int) ((r >> 32) % 20);
+            if(op == 0){
+                clht.insert(key, key);
+                return (size_t) 0;
+            }
+            if(op == 1){
+                return (size_t) clht.remove(key);
+            }
+            return (size_t) clht.count(key);
+        });
+
+        std::cout << num_threads << " | " << locked << " | " << concurrent << "\n";
+    }
+}
+
+/*
+    File-backed table ten times larger than its buffer pool: random lookups must read about one page each.
+    Reads may still be served by the operating system's file cache, so this measures the page reads, not the disk.
+*/
+void bench_persistent(){
+    const int num_keys = 4000000;
+    const int num_lookups = 1000000;
+    std::string path = "bench_linear_hash.persistent";
+
+    /* About 0.8 * 255 keys per 4 KiB primary page. */
+    size_t table_pages = num_keys / 204;
+    size_t pool_pages = table_pages / 10;
+
+    {
+        PersistentLinearHashTable<long long, long long> plht(path, 16, 0, pool_pages);
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_keys; ++i){
+            plht.insert((long long) i * 7, i);
+        }
+        plht.sync();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Persistent inserts: " << num_keys / elapsed.count() / 1e6 << " Mops/s, "
+                  << plht.get_num_buckets() << " buckets, " << plht.get_num_overflow_pages() << " overflow pages, "
+                  << pool_pages << " pages cached" << "\n";
+    }
+    {
+        PersistentLinearHashTable<long long, long long> plht(path, 16, 0, pool_pages);
+        XorShift rng(1);
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_lookups; ++i){
+            long long val = 0;
+            found += plht.find((long long) (rng.next() % num_keys) * 7, val);
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Persistent lookups: " << num_lookups / elapsed.count() / 1e6 << " Mops/s, "
+                  << (double) plht.get_page_reads() / num_lookups << " page reads per lookup, "
+                  << found << " found" << "\n";
+    }
+    std::remove((path + ".buckets").c_str());
+    std::remove((path + ".overflow").c_str());
+}
+
+int main(){
+    bench_concurrency();
+    bench_persistent();
+}
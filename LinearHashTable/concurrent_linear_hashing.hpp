@@ -0,0 +1,566 @@
+/*
+    Concurrent Linear Hashing in C++.
+    Author: Ameya Daigavane
+
+    A thread-safe variant of LinearHashTable, for trivially copyable keys and values.
+    Readers normally take no lock: they read the level and split pointer together from one atomic word, and every
+    bucket carries a version counter (a seqlock), which is odd while a writer is modifying the bucket. Readers
+    retry if the version changed under them, or if a split moved their key to another bucket meanwhile. After a
+    few retries, a reader takes the bucket's lock stripe like a writer, so that writers cannot starve it.
+    Writers lock only the bucket they modify, through a fixed array of lock stripes rather than a lock per bucket,
+    which keeps buckets small enough to pack several per cache line. Splits happen one at a time, in split pointer order, run by
+    whichever inserting thread first finds the load factor above the threshold.
+*/
+
+#ifndef CONCURRENT_LINEAR_HASHING_HPP
+#define CONCURRENT_LINEAR_HASHING_HPP
+
+#include <vector>
+#include <cassert>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include "linear_hashing.hpp"
+
+/* Most chunks or segments of doubling sizes that a table can use: enough for any 64-bit index. */
+const size_t max_segments = 64;
+
+/*
+    Pool of pages shared by all buckets, as PagePool, but safe to read while other threads allocate.
+    Chunk k holds chunk_pages << k pages, so a fixed table of chunk pointers covers every page id, and chunks are
+    only freed with the pool: readers holding a stale page id always read valid memory, and detect staleness
+    through their bucket's version.
+*/
+template <typename KEY, typename VAL>
+class ConcurrentPagePool {
+
+    static const size_t chunk_pages = 1024;
+
+    size_t page_slots;
+    std::atomic<size_t> num_pages;
+    std::atomic<std::atomic<KEY>*> key_chunks[max_segments];
+    std::atomic<std::atomic<VAL>*> val_chunks[max_segments];
+    std::atomic<std::atomic<size_t>*> next_chunks[max_segments];
+
+    /* Taken by allocate() and release(). */
+    std::mutex lock;
+    std::vector<size_t> free_ids;
+
+    /* Chunk holding page id, and the index of its first page. */
+    static size_t chunk_of(size_t id){
+        return highest_bit(id / chunk_pages + 1);
+    }
+
+    static size_t chunk_start(size_t k){
+        return (((size_t) 1 << k) - 1) * chunk_pages;
+    }
+
+    public:
+    ConcurrentPagePool(size_t page_slots) : num_pages(0) {
+        this -> page_slots = page_slots;
+        for(size_t k = 0; k < max_segments; ++k){
+            key_chunks[k].store(NULL, std::memory_order_relaxed);
+            val_chunks[k].store(NULL, std::memory_order_relaxed);
+            next_chunks[k].store(NULL, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentPagePool(const ConcurrentPagePool&) = delete;
+    ConcurrentPagePool& operator=(const ConcurrentPagePool&) = delete;
+
+    ~ConcurrentPagePool(){
+        for(size_t k = 0; k < max_segments; ++k){
+            delete[] key_chunks[k].load(std::memory_order_relaxed);
+            delete[] val_chunks[k].load(std::memory_order_relaxed);
+            delete[] next_chunks[k].load(std::memory_order_relaxed);
+        }
+    }
+
+    /* Take a free page, or carve a new one, linked in front of page next. Returns its id. */
+    size_t allocate(size_t next){
+        std::lock_guard<std::mutex> guard(lock);
+        size_t id;
+
+        if(!free_ids.empty()){
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = num_pages.load(std::memory_order_relaxed);
+            size_t k = chunk_of(id);
+            if(id == chunk_start(k)){
+                size_t n = chunk_pages << k;
+                key_chunks[k].store(new std::atomic<KEY>[n * page_slots], std::memory_order_relaxed);
+                val_chunks[k].store(new std::atomic<VAL>[n * page_slots], std::memory_order_relaxed);
+                next_chunks[k].store(new std::atomic<size_t>[n], std::memory_order_relaxed);
+            }
+
+            /* Publish the chunk before any id pointing into it. */
+            num_pages.store(id + 1, std::memory_order_release);
+        }
+
+        next_page(id).store(next, std::memory_order_relaxed);
+        return id;
+    }
+
+    /* Put a page on the free list. Readers may still be reading it. */
+    void release(size_t id){
+        std::lock_guard<std::mutex> guard(lock);
+        free_ids.push_back(id);
+    }
+
+    /* True if id is a page that has been carved, which may be read even if it is free. */
+    bool is_page(size_t id){
+        return id < num_pages.load(std::memory_order_acquire);
+    }
+
+    /* Keys of page id. */
+    std::atomic<KEY>* page_keys(size_t id){
+        size_t k = chunk_of(id);
+        return key_chunks[k].load(std::memory_order_relaxed) + (id - chunk_start(k)) * page_slots;
+    }
+
+    /* Values of page id. */
+    std::atomic<VAL>* page_vals(size_t id){
+        size_t k = chunk_of(id);
+        return val_chunks[k].load(std::memory_order_relaxed) + (id - chunk_start(k)) * page_slots;
+    }
+
+    /* The page following page id in its chain. */
+    std::atomic<size_t>& next_page(size_t id){
+        size_t k = chunk_of(id);
+        return next_chunks[k].load(std::memory_order_relaxed)[id - chunk_start(k)];
+    }
+
+    /* Number of slots in each page. */
+    size_t get_page_slots(){
+        return page_slots;
+    }
+};
+
+/* A chain of pages, laid out as in HashBucket: the head page is the only partially filled one. */
+struct ConcurrentLinearBucket {
+
+    /* Even when the bucket is stable, odd while a writer is modifying it. */
+    std::atomic<size_t> version;
+
+    std::atomic<size_t> num_keys;
+    std::atomic<size_t> head;
+
+    ConcurrentLinearBucket() : version(0), num_keys(0), head(no_page) {}
+
+    /* Writers bracket their modifications with these, while holding the bucket's lock stripe. */
+    void begin_write(){
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write(){
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+template <typename KEY, typename VAL, typename Hasher = MixHash<KEY>>
+class ConcurrentLinearHashTable {
+
+    static_assert(std::is_trivially_copyable<KEY>::value && std::is_trivially_copyable<VAL>::value,
+                  "ConcurrentLinearHashTable needs trivially copyable keys and values.");
+
+    typedef ConcurrentLinearBucket Bucket;
+
+    /* The split state packs the level into its top bits and the split pointer below, so both are read at once. */
+    static const size_t level_shift = 56;
+
+    size_t init_buckets;
+    size_t page_slots;
+    double max_load;
+    std::atomic<size_t> num_keys;
+    std::atomic<uint64_t> split_state;
+
+    /* Buckets, in segments of doubling sizes as in SegmentedArray. Segments are only freed with the table. */
+    std::atomic<Bucket*> segments[max_segments];
+
+    ConcurrentPagePool<KEY, VAL> pages;
+    Hasher hasher;
+
+    /* Held by the thread running splits. */
+    std::mutex split_mutex;
+
+    /* Lock-free attempts of a lookup before it takes the bucket's lock stripe. */
+    static const size_t optimistic_reads = 8;
+
+    /* Bucket index i is guarded by bucket_locks[i % num_lock_stripes]. */
+    static const size_t num_lock_stripes = 1024;
+    std::mutex bucket_locks[num_lock_stripes];
+
+    std::mutex& bucket_lock(size_t index){
+        return bucket_locks[index % num_lock_stripes];
+    }
+
+    size_t hash(const KEY& key){
+        return hasher(key);
+    }
+
+    static size_t level_of(uint64_t state){
+        return (size_t) (state >> level_shift);
+    }
+
+    static size_t split_index_of(uint64_t state){
+        return (size_t) (state & (((uint64_t) 1 << level_shift) - 1));
+    }
+
+    size_t split_demarcation(size_t level){
+        return ((size_t) 1 << level) * init_buckets;
+    }
+
+    /* Index of the bucket for this hash value, under this split state. */
+    size_t bucket_index(size_t hash_val, uint64_t state){
+        size_t level = level_of(state);
+        size_t index = hash_val % split_demarcation(level);
+
+        if(index < split_index_of(state)){
+            index = hash_val % split_demarcation(level + 1);
+        }
+        return index;
+    }
+
+    Bucket* bucket_at(size_t index){
+        size_t k = highest_bit(index + 1);
+        return segments[k].load(std::memory_order_acquire) + (index + 1 - ((size_t) 1 << k));
+    }
+
+    /* Allocate the segment holding bucket index, if needed. Only called with split_mutex held, or in the constructor. */
+    void add_bucket(size_t index){
+        size_t k = highest_bit(index + 1);
+        if(segments[k].load(std::memory_order_relaxed) == NULL){
+            segments[k].store(new Bucket[(size_t) 1 << k], std::memory_order_release);
+        }
+    }
+
+    /*
+        Looks for key in the chain starting at head, holding size keys. Sets page and slot and returns true if found.
+        Safe on a torn snapshot of a bucket: reads at most the pages size keys need, and only carved pages.
+    */
+    bool find_slot(size_t head, size_t size, const KEY& key, size_t& page, size_t& slot){
+        size_t used = size == 0 ? 0 : (size - 1) % page_slots + 1;
+        size_t num_pages = (size + page_slots - 1) / page_slots;
+
+        page = head;
+        for(size_t p = 0; p < num_pages && pages.is_page(page); ++p){
+            std::atomic<KEY>* keys = pages.page_keys(page);
+            for(size_t i = 0; i < used; ++i){
+                if(keys[i].load(std::memory_order_relaxed) == key){
+                    slot = i;
+                    return true;
+                }
+            }
+
+            /* Pages after the head are full. */
+            used = page_slots;
+            page = pages.next_page(page).load(std::memory_order_relaxed);
+        }
+        return false;
+    }
+
+    /* Append a key known to be absent to bucket, whose lock stripe the caller holds, inside a write section. */
+    void append(Bucket* bucket, const KEY& key, const VAL& val){
+        size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+        size_t head = bucket -> head.load(std::memory_order_relaxed);
+
+        /* Link in a new head page if the current one is full. */
+        if(size % page_slots == 0){
+            head = pages.allocate(head);
+            bucket -> head.store(head, std::memory_order_relaxed);
+        }
+
+        size_t slot = size % page_slots;
+        pages.page_keys(head)[slot].store(key, std::memory_order_relaxed);
+        pages.page_vals(head)[slot].store(val, std::memory_order_relaxed);
+        bucket -> num_keys.store(size + 1, std::memory_order_relaxed);
+    }
+
+    /*
+        Remove the pair in this slot of bucket, by moving the last pair into it, inside a write section.
+        Returns true if the head page was emptied and released.
+    */
+    bool remove_slot(Bucket* bucket, size_t page, size_t slot){
+        size_t size = bucket -> num_keys.load(std::memory_order_relaxed);
+        size_t head = bucket -> head.load(std::memory_order_relaxed);
+        size_t last = (size - 1) % page_slots;
+
+        if(page != head || slot != last){
+            pages.page_keys(page)[slot].store(pages.page_keys(head)[last].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            pages.page_vals(page)[slot].store(pages.page_vals(head)[last].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        bucket -> num_keys.store(size - 1, std::memory_order_relaxed);
+
+        /* Give the head page back once it is empty. */
+        if(last == 0){
+            bucket -> head.store(pages.next_page(head).load(std::memory_order_relaxed), std::memory_order_relaxed);
+            pages.release(head);
+            return true;
+        }
+        return false;
+    }
+
+    /* Run op(bucket) on the bucket holding hash_val, with its lock stripe held. */
+    template <typename OP>
+    void locked_update(size_t hash_val, OP op){
+        while(true){
+            size_t index = bucket_index(hash_val, split_state.load());
+            Bucket* bucket = bucket_at(index);
+
+            std::lock_guard<std::mutex> guard(bucket_lock(index));
+
+            /*
+                A split moved this key elsewhere since we read the split state. Splitting a bucket needs its
+                lock, so with the lock held, the key's bucket cannot change any more.
+            */
+            if(bucket_index(hash_val, split_state.load()) != index){
+                continue;
+            }
+
+            op(bucket);
+            return;
+        }
+    }
+
+    /*
+        Split the bucket at the split pointer, with split_mutex held.
+        The pairs that move are copied into the new bucket before the split pointer advances, and only removed
+        from the old bucket afterwards, so readers find every key at every point. Both buckets stay locked until
+        then, so that no writer can touch a key that still has a stale copy.
+    */
+    void split_bucket(){
+        uint64_t state = split_state.load();
+        size_t level = level_of(state);
+        size_t split_index = split_index_of(state);
+        size_t index2 = split_index + split_demarcation(level);
+
+        add_bucket(index2);
+        Bucket* bucket1 = bucket_at(split_index);
+        Bucket* bucket2 = bucket_at(index2);
+
+        /* Writers only ever hold one stripe and splits run one at a time, so taking two cannot deadlock. Both may be the same. */
+        std::unique_lock<std::mutex> guard1(bucket_lock(split_index));
+        std::unique_lock<std::mutex> guard2;
+        if(&bucket_lock(index2) != &bucket_lock(split_index)){
+            guard2 = std::unique_lock<std::mutex>(bucket_lock(index2));
+        }
+
+        /* Copy the pairs that move into the new bucket, which no one can reach yet. */
+        size_t size = bucket1 -> num_keys.load(std::memory_order_relaxed);
+        size_t used = size == 0 ? 0 : (size - 1) % page_slots + 1;
+        for(size_t page = bucket1 -> head.load(std::memory_order_relaxed); page != no_page; page = pages.next_page(page).load(std::memory_order_relaxed)){
+            for(size_t i = 0; i < used; ++i){
+                KEY key = pages.page_keys(page)[i].load(std::memory_order_relaxed);
+                if(hash(key) % split_demarcation(level + 1) == index2){
+                    append(bucket2, key, pages.page_vals(page)[i].load(std::memory_order_relaxed));
+                }
+            }
+            used = page_slots;
+        }
+
+        /* Advance the split pointer, moving to the next level once every bucket of this level is split. */
+        if(split_index + 1 == split_demarcation(level)){
+            split_state.store((uint64_t) (level + 1) << level_shift);
+        } else {
+            split_state.store(state + 1);
+        }
+
+        /* Drop the moved pairs from the old bucket, head page first as in LinearHashTable::rehash(). */
+        bucket1 -> begin_write();
+        size_t page = bucket1 -> head.load(std::memory_order_relaxed);
+        while(page != no_page){
+            size_t next = pages.next_page(page).load(std::memory_order_relaxed);
+
+            size_t i = 0;
+            while(true){
+                size_t size1 = bucket1 -> num_keys.load(std::memory_order_relaxed);
+                bool is_head = page == bucket1 -> head.load(std::memory_order_relaxed);
+                if(size1 == 0 || i >= (is_head ? (size1 - 1) % page_slots + 1 : page_slots)){
+                    break;
+                }
+
+                KEY key = pages.page_keys(page)[i].load(std::memory_order_relaxed);
+                if(hash(key) % split_demarcation(level + 1) != index2){
+                    i += 1;
+                    continue;
+                }
+
+                if(remove_slot(bucket1, page, i) && is_head){
+                    break;
+                }
+            }
+
+            page = next;
+        }
+        bucket1 -> end_write();
+    }
+
+    /*
+        Split while the load factor is above the threshold, unless another thread is already splitting.
+        Inserts which find the lock taken leave their split to its holder, so the holder checks the load
+        again once it has let go of the lock, and splits on if one of them came in after its last check.
+    */
+    void maybe_split(){
+        while(get_load_factor() > max_load){
+            std::unique_lock<std::mutex> guard(split_mutex, std::try_to_lock);
+            if(!guard.owns_lock()){
+                return;
+            }
+            while(get_load_factor() > max_load){
+                split_bucket();
+            }
+            guard.unlock();
+        }
+    }
+
+    public:
+    ConcurrentLinearHashTable(size_t num_buckets = 10, size_t page_slots = 3, double max_load = 0.8)
+        : num_keys(0), split_state(0), pages(page_slots) {
+        assert(num_buckets > 0 && page_slots > 0 && max_load > 0);
+
+        this -> init_buckets = num_buckets;
+        this -> page_slots = page_slots;
+        this -> max_load = max_load;
+
+        for(size_t k = 0; k < max_segments; ++k){
+            segments[k].store(NULL, std::memory_order_relaxed);
+        }
+        for(size_t i = 0; i < num_buckets; ++i){
+            add_bucket(i);
+        }
+    }
+
+    ConcurrentLinearHashTable(const ConcurrentLinearHashTable&) = delete;
+    ConcurrentLinearHashTable& operator=(const ConcurrentLinearHashTable&) = delete;
+
+    ~ConcurrentLinearHashTable(){
+        for(size_t k = 0; k < max_segments; ++k){
+            delete[] segments[k].load(std::memory_order_relaxed);
+        }
+    }
+
+    /* Insert into the hash table, overwriting the value if the key is already present. */
+    void insert(KEY key, VAL val){
+        bool added = false;
+        locked_update(hash(key), [&](Bucket* bucket){
+            size_t page, slot;
+            bool found = find_slot(bucket -> head.load(std::memory_order_relaxed), bucket -> num_keys.load(std::memory_order_relaxed), key, page, slot);
+
+            bucket -> begin_write();
+            if(found){
+                pages.page_vals(page)[slot].store(val, std::memory_order_relaxed);
+            } else {
+                append(bucket, key, val);
+                added = true;
+            }
+            bucket -> end_write();
+        });
+
+        if(added){
+            num_keys.fetch_add(1, std::memory_order_relaxed);
+            maybe_split();
+        }
+    }
+
+    /* Delete a key from the hash table. Returns false if the key was not present. */
+    bool remove(KEY key){
+        bool removed = false;
+        locked_update(hash(key), [&](Bucket* bucket){
+            size_t page, slot;
+            if(!find_slot(bucket -> head.load(std::memory_order_relaxed), bucket -> num_keys.load(std::memory_order_relaxed), key, page, slot)){
+                return;
+            }
+
+            bucket -> begin_write();
+            remove_slot(bucket, page, slot);
+            bucket -> end_write();
+            removed = true;
+        });
+
+        if(removed){
+            num_keys.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return removed;
+    }
+
+    /*
+        Looks up key, without locking unless writers keep changing its bucket. Returns true and sets val if
+        the key is present.
+    */
+    bool find(KEY key, VAL& val){
+        size_t hash_val = hash(key);
+
+        for(size_t attempt = 0; attempt < optimistic_reads; ++attempt){
+            uint64_t state = split_state.load();
+            size_t index = bucket_index(hash_val, state);
+            Bucket* bucket = bucket_at(index);
+
+            size_t version = bucket -> version.load(std::memory_order_acquire);
+            if(version & 1){
+                continue;
+            }
+
+            size_t page, slot;
+            bool found = find_slot(bucket -> head.load(std::memory_order_relaxed), bucket -> num_keys.load(std::memory_order_relaxed), key, page, slot);
+            VAL found_val = VAL();
+            if(found){
+                found_val = pages.page_vals(page)[slot].load(std::memory_order_relaxed);
+            }
+
+            /* Retry if a writer touched the bucket meanwhile. */
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(bucket -> version.load(std::memory_order_relaxed) != version){
+                continue;
+            }
+
+            /* Retry if a split moved the key to another bucket meanwhile. Splits of other buckets do not matter. */
+            uint64_t state2 = split_state.load();
+            if(state2 != state && bucket_index(hash_val, state2) != index){
+                continue;
+            }
+
+            if(found){
+                val = found_val;
+            }
+            return found;
+        }
+
+        /* Read under the bucket's lock stripe, which writers of the bucket take turns with. */
+        bool found = false;
+        locked_update(hash_val, [&](Bucket* bucket){
+            size_t page, slot;
+            found = find_slot(bucket -> head.load(std::memory_order_relaxed), bucket -> num_keys.load(std::memory_order_relaxed), key, page, slot);
+            if(found){
+                val = pages.page_vals(page)[slot].load(std::memory_order_relaxed);
+            }
+        });
+        return found;
+    }
+
+    /* Checks if key is present in the hash table. */
+    bool count(KEY key){
+        VAL val;
+        return find(key, val);
+    }
+
+    /* Returns the total number of key-value pairs. */
+    size_t size(){
+        return num_keys.load(std::memory_order_relaxed);
+    }
+
+    /* Returns the number of buckets. */
+    size_t get_num_buckets(){
+        uint64_t state = split_state.load();
+        return split_demarcation(level_of(state)) + split_index_of(state);
+    }
+
+    /* Returns the number of keys over the number of slots in all buckets' primary pages. */
+    double get_load_factor(){
+        return (double) size() / ((double) get_num_buckets() * page_slots);
+    }
+};
+
+#endif
@@ -3,299 +3,741 @@
     Author: Ameya Daigavane
 */
 
+#ifndef LINEAR_HASHING_HPP
+#define LINEAR_HASHING_HPP
+
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <new>
+#include "../ExtendibleHashTable/hashers.hpp"
+#include "../ExtendibleHashTable/probing.hpp"
+
+/* Index of the highest set bit of x, which must be nonzero. */
+inline size_t highest_bit(uint64_t x){
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(x);
+#else
+    size_t i = 0;
+    while(x >>= 1){
+        i += 1;
+    }
+    return i;
+#endif
+}
 
+/*
+    Array of segments of doubling sizes: segment k holds the 2^k items from index 2^k - 1 on.
+    Growing allocates a new segment and never moves existing items, so references to them stay valid, and
+    no push_back copies the array. Segments are allocated uninitialized, so allocating one costs the same
+    whatever its size. The last segment is given back once it is empty and the one before is at most half full.
+*/
 template <typename T>
-class HashBucket {
+class SegmentedArray {
 
-	public:
-	int num_keys;
-	int num_slots;
-	std::vector <T> slots;
-	std::vector <T> overflows;
+    std::vector<T*> segments;
+    size_t num_items;
+    std::allocator<T> allocator;
 
-	HashBucket(int num_slots){
-		this -> num_slots = num_slots;
-		this -> num_keys = 0;
-	}
+    /* Segment holding index i. */
+    static size_t segment_of(size_t i){
+        return highest_bit(i + 1);
+    }
 
-	/* Insert into this bucket. */
-	void insert(T key){
-		if(!isFull()){
-			slots.push_back(key);
-		} else {
-			overflows.push_back(key);
-		}
+    /* Index of the first item of segment k. */
+    static size_t segment_start(size_t k){
+        return ((size_t) 1 << k) - 1;
+    }
 
-		num_keys += 1;
+    public:
+    SegmentedArray(){
+        this -> num_items = 0;
+    }
 
-        /* Invariant. */
-        assert(num_keys == slots.size() + overflows.size());
-	}
+    SegmentedArray(const SegmentedArray&) = delete;
+    SegmentedArray& operator=(const SegmentedArray&) = delete;
 
-	/* Remove the last element in this bucket and return it. */
-	T pop(){
-		assert(num_keys > 0);
+    ~SegmentedArray(){
+        while(num_items > 0){
+            pop_back();
+        }
+        for(size_t k = 0; k < segments.size(); ++k){
+            allocator.deallocate(segments[k], (size_t) 1 << k);
+        }
+    }
 
-		T key;
-		if(num_keys <= num_slots){
-			key = slots.back();
-			slots.pop_back();
-		} else {
-			key = overflows.back();
-			overflows.pop_back();
-		}
+    T& operator[](size_t i){
+        size_t k = segment_of(i);
+        return segments[k][i - segment_start(k)];
+    }
 
-        num_keys -= 1;
+    T& back(){
+        return (*this)[num_items - 1];
+    }
 
-        /* Invariant. */
-        assert(num_keys == slots.size() + overflows.size());
+    void push_back(const T& item){
+        size_t k = segment_of(num_items);
+        if(k == segments.size()){
+            segments.push_back(allocator.allocate((size_t) 1 << k));
+        }
 
-        return key;
-	}
+        new (&segments[k][num_items - segment_start(k)]) T(item);
+        num_items += 1;
+    }
 
-    /* Checks if key is present in this bucket. */
-    bool count(T key){
-        for(int i = 0; i < slots.size(); ++i){
-            if(slots[i] == key){
-                return true;
-            }
+    void pop_back(){
+        back().~T();
+        num_items -= 1;
+
+        /* Keeping the empty last segment until the one before is half empty avoids thrashing at a boundary. */
+        size_t last = segments.size() - 1;
+        if(last >= 1 && num_items <= segment_start(last - 1) + ((size_t) 1 << (last - 1)) / 2){
+            allocator.deallocate(segments[last], (size_t) 1 << last);
+            segments.pop_back();
         }
+    }
+
+    size_t size(){
+        return num_items;
+    }
+
+    /* Number of items the allocated segments can hold. */
+    size_t capacity(){
+        return segment_start(segments.size());
+    }
+};
+
+/* Page id marking the end of a chain. */
+const size_t no_page = (size_t) -1;
 
-        for(int i = 0; i < overflows.size(); ++i){
-            if(overflows[i] == key){
-                return true;
+/*
+    Pool of fixed-size pages, each holding page_slots key-value pairs and the id of the next page in its chain.
+    Pages are carved out of large chunks, which never move, and freed pages are reused before new ones are carved,
+    so buckets growing and shrinking their chains do not go through the allocator.
+    Every slot also carries a one-byte fingerprint of its key's hash, in an array padded to whole groups of
+    tag_group_width, so probes compare a whole page of fingerprints at once and only look at matching keys.
+*/
+template <typename KEY, typename VAL>
+class PagePool {
+
+    size_t page_slots;
+    size_t tag_stride;
+    size_t chunk_pages;
+    size_t num_pages;
+    std::vector<size_t> free_ids;
+    std::vector<std::unique_ptr<KEY[]>> key_chunks;
+    std::vector<std::unique_ptr<VAL[]>> val_chunks;
+    std::vector<std::unique_ptr<uint8_t[]>> tag_chunks;
+    std::vector<std::unique_ptr<size_t[]>> next_chunks;
+
+    public:
+    PagePool(size_t page_slots, size_t chunk_pages = 1024){
+        this -> page_slots = page_slots;
+        this -> tag_stride = ((page_slots + tag_group_width - 1) / tag_group_width) * tag_group_width;
+        this -> chunk_pages = chunk_pages;
+        this -> num_pages = 0;
+    }
+
+    /* Take a free page, or carve a new one, linked in front of page next. Returns its id. */
+    size_t allocate(size_t next){
+        size_t id;
+
+        if(!free_ids.empty()){
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            if(num_pages == key_chunks.size() * chunk_pages){
+                key_chunks.push_back(std::unique_ptr<KEY[]>(new KEY[chunk_pages * page_slots]));
+                val_chunks.push_back(std::unique_ptr<VAL[]>(new VAL[chunk_pages * page_slots]));
+                tag_chunks.push_back(std::unique_ptr<uint8_t[]>(new uint8_t[chunk_pages * tag_stride]()));
+                next_chunks.push_back(std::unique_ptr<size_t[]>(new size_t[chunk_pages]));
             }
+            id = num_pages;
+            num_pages += 1;
         }
 
-        return false;
+        next_page(id) = next;
+        return id;
     }
 
-    /* Delete key from bucket. */
-    void del(T key){
-        assert(count(key));
+    /* Put a page on the free list. Its slots must already have been reset. */
+    void release(size_t id){
+        free_ids.push_back(id);
+    }
+
+    /* Keys of page id. */
+    KEY* page_keys(size_t id){
+        return key_chunks[id / chunk_pages].get() + (id % chunk_pages) * page_slots;
+    }
+
+    /* Values of page id. */
+    VAL* page_vals(size_t id){
+        return val_chunks[id / chunk_pages].get() + (id % chunk_pages) * page_slots;
+    }
 
-        /* First check overflow slots. */
-        for(int i = 0; i < overflows.size(); ++i){
-            if(overflows[i] == key){
-                overflows.erase(overflows.begin() + i);
-                return;
+    /* Fingerprints of page id. */
+    uint8_t* page_tags(size_t id){
+        return tag_chunks[id / chunk_pages].get() + (id % chunk_pages) * tag_stride;
+    }
+
+    /* The page following page id in its chain. */
+    size_t& next_page(size_t id){
+        return next_chunks[id / chunk_pages][id % chunk_pages];
+    }
+
+    /* Number of pages in use. */
+    size_t num_live_pages(){
+        return num_pages - free_ids.size();
+    }
+
+    /* Number of pages carved out of chunks, including free ones. */
+    size_t num_carved_pages(){
+        return num_pages;
+    }
+
+    /* Free page ids below bound. */
+    std::vector<size_t> free_pages_below(size_t bound){
+        std::vector<size_t> ids;
+        for(size_t i = 0; i < free_ids.size(); ++i){
+            if(free_ids[i] < bound){
+                ids.push_back(free_ids[i]);
             }
         }
+        return ids;
+    }
+
+    /* Move the contents and link of page from into free page to. Whoever linked to from must be relinked to to. */
+    void move_page(size_t from, size_t to){
+        for(size_t i = 0; i < page_slots; ++i){
+            page_keys(to)[i] = std::move(page_keys(from)[i]);
+            page_vals(to)[i] = std::move(page_vals(from)[i]);
+            page_tags(to)[i] = page_tags(from)[i];
+            page_keys(from)[i] = KEY();
+            page_vals(from)[i] = VAL();
+        }
+        next_page(to) = next_page(from);
+    }
+
+    /*
+        Forget every page from id num_pages on, and give back the chunks holding only such pages.
+        All pages in use must have lower ids.
+    */
+    void truncate(size_t num_pages){
+        this -> num_pages = num_pages;
+        free_ids.clear();
+
+        size_t num_chunks = (num_pages + chunk_pages - 1) / chunk_pages;
+        key_chunks.resize(num_chunks);
+        val_chunks.resize(num_chunks);
+        tag_chunks.resize(num_chunks);
+        next_chunks.resize(num_chunks);
+    }
+
+    /* Number of pages in each chunk. */
+    size_t get_chunk_pages(){
+        return chunk_pages;
+    }
+
+    /* Number of slots in each page. */
+    size_t get_page_slots(){
+        return page_slots;
+    }
+};
+
+/*
+    A bucket is a chain of pages from the pool, holding num_keys pairs. The first page of the chain is the only
+    partially filled one: new pages are linked in at the head, so the last pair, which deletes swap into the hole
+    they leave, is always in the head page.
+*/
+template <typename KEY, typename VAL>
+class HashBucket {
+
+	public:
+	size_t num_keys;
+    size_t head;
+
+	HashBucket(){
+		this -> num_keys = 0;
+        this -> head = no_page;
+	}
+
+    /* Slot of the last pair in the head page. */
+    size_t last_slot(PagePool<KEY, VAL>& pool){
+        return (num_keys - 1) % pool.get_page_slots();
+    }
+
+    /* Returns the page and slot holding key (with fingerprint tag), or no_page if the key is absent. */
+    std::pair<size_t, size_t> find_slot(PagePool<KEY, VAL>& pool, const KEY& key, uint8_t tag){
+        size_t used = num_keys == 0 ? 0 : last_slot(pool) + 1;
+
+        size_t page = head;
+        while(page != no_page){
+
+            /* Start loading the next page of the chain while this one is probed. */
+            size_t next = pool.next_page(page);
+            if(next != no_page){
+                prefetch(pool.page_tags(next));
+            }
 
-        /* Then check original slots. */
-        for(int i = 0; i < slots.size(); ++i){
-            if(slots[i] == key){
-                slots.erase(slots.begin() + i);
-                return;
+            KEY* keys = pool.page_keys(page);
+            uint8_t* tags = pool.page_tags(page);
+            for(size_t group = 0; group < used; group += tag_group_width){
+                uint32_t matches = match_tag_group(tags + group, tag);
+
+                /* Ignore slots past the end of the page. */
+                if(used - group < 32){
+                    matches &= ((uint32_t) 1 << (used - group)) - 1;
+                }
+
+                /* Only fingerprint matches are compared against the full key. */
+                while(matches){
+                    size_t i = group + lowest_bit(matches);
+                    if(keys[i] == key){
+                        return std::make_pair(page, i);
+                    }
+                    matches &= matches - 1;
+                }
             }
+
+            /* Pages after the head are full. */
+            used = pool.get_page_slots();
+            page = next;
+        }
+
+        return std::make_pair(no_page, (size_t) 0);
+    }
+
+	/* Append a key known to be absent, with fingerprint tag, moving from key and val when given rvalues. */
+    template <typename K, typename V>
+	void insert(PagePool<KEY, VAL>& pool, K&& key, V&& val, uint8_t tag){
+
+        /* Link in a new head page if the current one is full. */
+        if(num_keys % pool.get_page_slots() == 0){
+            head = pool.allocate(head);
+        }
+
+        num_keys += 1;
+        pool.page_keys(head)[last_slot(pool)] = std::forward<K>(key);
+        pool.page_vals(head)[last_slot(pool)] = std::forward<V>(val);
+        pool.page_tags(head)[last_slot(pool)] = tag;
+	}
+
+    /*
+        Remove the pair in this slot, by moving the last pair of the bucket into it. The vacated last slot is then
+        reset, so that whatever its key and value own is released now rather than when the slot is reused.
+    */
+    void remove_slot(PagePool<KEY, VAL>& pool, size_t page, size_t slot){
+        size_t last = last_slot(pool);
+        if(page != head || slot != last){
+            pool.page_keys(page)[slot] = std::move(pool.page_keys(head)[last]);
+            pool.page_vals(page)[slot] = std::move(pool.page_vals(head)[last]);
+            pool.page_tags(page)[slot] = pool.page_tags(head)[last];
         }
+        pool.page_keys(head)[last] = KEY();
+        pool.page_vals(head)[last] = VAL();
+
+        num_keys -= 1;
+
+        /* Give the head page back once it is empty. */
+        if(last == 0){
+            size_t old_head = head;
+            head = pool.next_page(head);
+            pool.release(old_head);
+        }
+    }
+
+    /*
+        Move the pair in this slot to the end of bucket to, filling the hole with the last pair.
+        Returns true if that emptied and released this bucket's head page.
+    */
+    bool move_slot(PagePool<KEY, VAL>& pool, size_t page, size_t slot, HashBucket& to){
+        to.insert(pool, std::move(pool.page_keys(page)[slot]), std::move(pool.page_vals(page)[slot]), pool.page_tags(page)[slot]);
+
+        size_t old_head = head;
+        remove_slot(pool, page, slot);
+        return head != old_head;
+    }
+
+	/* Remove the last pair in this bucket and return it. */
+	std::pair<KEY, VAL> pop(PagePool<KEY, VAL>& pool){
+		assert(num_keys > 0);
+
+        size_t last = last_slot(pool);
+        std::pair<KEY, VAL> item(std::move(pool.page_keys(head)[last]), std::move(pool.page_vals(head)[last]));
+        remove_slot(pool, head, last);
+
+        return item;
+	}
+
+    /* Checks if key is present in this bucket. */
+    bool count(PagePool<KEY, VAL>& pool, const KEY& key, uint8_t tag){
+        return find_slot(pool, key, tag).first != no_page;
+    }
+
+    /* Delete key from bucket, by moving the last pair into its slot. */
+    void del(PagePool<KEY, VAL>& pool, const KEY& key, uint8_t tag){
+        std::pair<size_t, size_t> found = find_slot(pool, key, tag);
+        assert(found.first != no_page);
+
+        remove_slot(pool, found.first, found.second);
     }
 
 	/* Get the number of keys in this bucket. */
-	int size(){
+	size_t size(){
 		return num_keys;
 	}
 
 	/* True if the bucket has no keys. */
 	bool isEmpty(){
-		return slots.size() == 0;
+		return num_keys == 0;
 	}
 
-	/* True if the bucket is full. */
-	bool isFull(){
-		return num_keys >= num_slots;
+	/* True if the bucket's primary page is full, so that further keys overflow. */
+	bool isFull(PagePool<KEY, VAL>& pool){
+		return num_keys >= pool.get_page_slots();
 	}
 
-	/* Print the contents of this bucket. */
-	void print(){
+	/* Print the contents of this bucket, head page first. */
+	void print(PagePool<KEY, VAL>& pool){
 		if(isEmpty()){
 			std::cout << "Empty." << "\n";
             return;
 		}
 
-		for(int i = 0; i < slots.size(); ++i){
-			std::cout << slots[i] << " ";
-		}
-
-		if(overflows.size() > 0){
-			std::cout << " ";
-			std::cout << "Overflows: ";
-
-			for(int i = 0; i < overflows.size(); ++i){
-				std::cout << overflows[i] << " ";
-			}
-		}
+        size_t used = last_slot(pool) + 1;
+        for(size_t page = head; page != no_page; page = pool.next_page(page)){
+            for(size_t i = 0; i < used; ++i){
+                std::cout << pool.page_keys(page)[i] << ":" << pool.page_vals(page)[i] << " ";
+            }
+            if(pool.next_page(page) != no_page){
+                std::cout << "| ";
+            }
+            used = pool.get_page_slots();
+        }
 		std::cout << "\n";
 	}
 };
 
-template <typename T>
+/*
+    Linear hash table mapping keys to values.
+    Keys are hashed with Hasher, which should mix its input well: bucket addresses are the hash value modulo the
+    number of buckets, so a weak hash sends keys with a common pattern to a few long chains. Bucket addresses,
+    sizes and counts are all 64-bit.
+*/
+template <typename KEY, typename VAL, typename Hasher = MixHash<KEY>>
 class LinearHashTable {
 
-	int num_buckets;
-	int init_buckets;
-	int level;
-	int split_index;
-	int overflow_limit;
-	std::vector<HashBucket<T>> buckets;
+	size_t num_buckets;
+	size_t init_buckets;
+	size_t level;
+	size_t split_index;
+	size_t overflow_limit;
+    size_t num_keys;
+    double max_load;
+    double min_load;
+    PagePool<KEY, VAL> pages;
+	SegmentedArray<HashBucket<KEY, VAL>> buckets;
+    Hasher hasher;
 
 	public:
-	LinearHashTable(int num_buckets = 10, int overflow_limit = 3){
+	LinearHashTable(size_t num_buckets = 10, size_t overflow_limit = 3) : pages(overflow_limit) {
+        assert(num_buckets > 0 && overflow_limit > 0);
+
 		this -> num_buckets = num_buckets;
 		this -> init_buckets = num_buckets;
 		this -> level = 0;
 		this -> split_index = 0;
 		this -> overflow_limit = overflow_limit;
+        this -> num_keys = 0;
+        this -> max_load = 0;
+        this -> min_load = 0;
 
-		HashBucket<T> new_bucket(overflow_limit);
-		for(int i = 0; i < num_buckets; ++i){
-			(this -> buckets).push_back(new_bucket);
-		}
+        for(size_t i = 0; i < num_buckets; ++i){
+            buckets.push_back(HashBucket<KEY, VAL>());
+        }
 	}
 
-	/* Main hash function used. Currently identity. */
-	int hash(T x){
-		return x;
+	/* Main hash function used. */
+	size_t hash(const KEY& key){
+		return hasher(key);
 	}
 
 	/* Hash function for each level. */
-	int hash_level(T x, int level){
-		return hash(x) % split_demarcation(level);
+	size_t hash_level(size_t hash_val, size_t level){
+		return hash_val % split_demarcation(level);
 	}
 
 	/* Indicates when to reset split index. */
-	int split_demarcation(int level){
-		return (1 << level) * init_buckets;
+	size_t split_demarcation(size_t level){
+		return ((size_t) 1 << level) * init_buckets;
 	}
 
-	/* Rehash between buckets with indices. */
-	void rehash(int index1, int index2){
-
-		HashBucket<T>& bucket1 = buckets[index1];
-		HashBucket<T>& bucket2 = buckets[index2];
-
-		T key;
-		int hash_val;
+    /* Index of the bucket for this hash value: buckets before the split index have already been split. */
+    size_t get_bucket_index(size_t hash_val){
+        size_t index = hash_level(hash_val, level);
 
-		std::vector<T> keys;
-
-		while (!bucket1.isEmpty()){
-			key = bucket1.pop();
-			keys.push_back(key);
-		}
-
-        // std::cout << "Keys to be rehashed: ";
-        // for(int i = 0; i < keys.size(); ++i){
-        //     std::cout << keys[i] << " ";
-        // }
-        // std::cout << "\n";
-
-		for (int i = 0; i < keys.size(); ++i){
-			key = keys[i];
+        if(index < split_index){
+            index = hash_level(hash_val, level + 1);
+        }
+        return index;
+    }
 
-            /* Recompute hash value with higher level hash. */
-			hash_val = hash_level(key, level + 1);
+	/*
+        Rehash between buckets with indices, in place: only the pairs whose higher level hash is index2 are moved,
+        and each hole is filled with the last pair of bucket index1. No temporary storage is used; the pages bucket
+        index2 grows into are mostly the ones bucket index1 gives back to the pool.
+    */
+	void rehash(size_t index1, size_t index2){
+        HashBucket<KEY, VAL>& bucket1 = buckets[index1];
+        HashBucket<KEY, VAL>& bucket2 = buckets[index2];
+        size_t page_slots = pages.get_page_slots();
+
+        /* Holes are filled from the head page, which is partitioned first, so pairs moved into holes always stay. */
+        size_t page = bucket1.head;
+        while(page != no_page){
+            size_t next = pages.next_page(page);
+
+            size_t i = 0;
+            while(true){
+                size_t used = (page == bucket1.head) ? bucket1.last_slot(pages) + 1 : page_slots;
+                if(bucket1.isEmpty() || i >= used){
+                    break;
+                }
+
+                /* Recompute hash value with higher level hash. */
+                size_t index = hash_level(hash(pages.page_keys(page)[i]), level + 1);
+                assert(index == index1 || index == index2);
+
+                if(index == index1){
+                    i += 1;
+                    continue;
+                }
+
+                /* Stop at the end of this page if it was the head page, and was emptied and released. */
+                bool was_head = page == bucket1.head;
+                if(bucket1.move_slot(pages, page, i, bucket2) && was_head){
+                    break;
+                }
+            }
 
-            /* Reinsert based on this hash value. */
-			buckets[hash_val].insert(key);
-		}
+            page = next;
+        }
 	}
 
-	/* Insert into the hash table according to the hash function. */
-	void insert(T key){
-		int hash_val = hash_level(key, level);
+	/* Insert into the hash table according to the hash function. Overwrites the value if the key is present. */
+	void insert(const KEY& key, const VAL& val){
+        size_t hash_val = hash(key);
+        uint8_t tag = hash_tag(hash_val);
+		size_t index = get_bucket_index(hash_val);
+        HashBucket<KEY, VAL>& bucket = buckets[index];
 
-		if(hash_val < split_index){
-			hash_val = hash_level(key, level + 1);
-		}
+        std::pair<size_t, size_t> found = bucket.find_slot(pages, key, tag);
+        if(found.first != no_page){
+            pages.page_vals(found.first)[found.second] = val;
+            return;
+        }
 
-		bool overflow = false;
-		if(buckets[hash_val].isFull()){
-			overflow = true;
-		}
+		bool overflow = bucket.isFull(pages);
 
         /* Insert into corresponding bucket. */
-		buckets[hash_val].insert(key);
+		bucket.insert(pages, key, val, tag);
+        num_keys += 1;
+
+        if(max_load > 0){
 
-        /* Split only if overflow occurs. */
-		if(overflow){
+            /* Controlled splitting: split while the load factor is above the threshold. */
+            while(get_load_factor() > max_load){
+                split_bucket();
+            }
+        } else if(overflow){
+
+            /* Split only if overflow occurs. */
 			split_bucket();
 		}
 	}
 
-    /* Searches for the key in the hash table. Returns the index of the bucket if found, and -1 if not. */
-    int search(T key){
-        int hash_val = hash_level(key, level);
+    /*
+        Switch to controlled splitting: split whenever the load factor (see get_load_factor()) exceeds max_load,
+        instead of whenever an insertion overflows a bucket. The number of buckets then grows with the number
+        of keys alone, whatever their distribution. Passing 0 switches back to splitting on overflow.
+    */
+    void set_max_load(double max_load){
+        assert(max_load >= 0);
+        assert(max_load == 0 || min_load < max_load);
+        this -> max_load = max_load;
+    }
+
+    /*
+        Contract the table under deletes: merge the last bucket back into its buddy and step the split pointer
+        back while the load factor is below min_load, down to the initial number of buckets. The bucket array
+        and the page pool give their memory back as the table shrinks. Passing 0 (the default) turns this off.
+        min_load must be below the max_load of controlled splitting, if set, so that the table does not keep
+        splitting and merging around one threshold.
+    */
+    void set_min_load(double min_load){
+        assert(min_load >= 0);
+        assert(max_load == 0 || min_load < max_load);
+        this -> min_load = min_load;
+    }
+
+    /* Returns the number of keys over the number of slots in all buckets' primary pages. */
+    double get_load_factor(){
+        return (double) num_keys / ((double) num_buckets * overflow_limit);
+    }
 
-        if(hash_val < split_index){
-            hash_val = hash_level(key, level + 1);
+    /* Returns a pointer to the value of key, or NULL if absent. Valid until the next insert or delete. */
+    VAL* find(const KEY& key){
+        size_t hash_val = hash(key);
+        std::pair<size_t, size_t> found = buckets[get_bucket_index(hash_val)].find_slot(pages, key, hash_tag(hash_val));
+        if(found.first == no_page){
+            return NULL;
         }
+        return pages.page_vals(found.first) + found.second;
+    }
+
+    /* Searches for the key in the hash table. Returns the index of the bucket if found, and -1 if not. */
+    long long search(const KEY& key){
+        size_t hash_val = hash(key);
+        size_t index = get_bucket_index(hash_val);
 
-        if(buckets[hash_val].count(key)){
-            return hash_val;
+        if(buckets[index].count(pages, key, hash_tag(hash_val))){
+            return (long long) index;
         } else {
             return -1;
         }
     }
 
     /* Delete a key from the hash table. */
-    void del(T key){
+    void del(const KEY& key){
 
-        /* Key must be present in the hash table. */
-        int index = search(key);
-        assert(index != -1);
+        /* Key must be present in the hash table: HashBucket::del() checks. */
+        size_t hash_val = hash(key);
+        size_t index = get_bucket_index(hash_val);
 
         /* Delete from corresponding bucket. */
-        buckets[index].del(key);
+        buckets[index].del(pages, key, hash_tag(hash_val));
+        num_keys -= 1;
+
+        if(min_load > 0){
+            while(num_buckets > init_buckets && get_load_factor() < min_load){
+                merge_bucket();
+            }
+
+            /* Once most carved pages are free, move the live ones down and give the rest back. */
+            if(pages.num_live_pages() < pages.num_carved_pages() / 4 && pages.num_carved_pages() > pages.get_chunk_pages()){
+                compact_pages();
+            }
+        }
     }
 
     /* Checks if key is present in the hash table. */
-    bool count(T key){
+    bool count(const KEY& key){
         return (search(key) != -1);
     }
 
+    /* Returns the total number of key-value pairs. */
+    size_t size(){
+        return num_keys;
+    }
+
+    /* Returns the number of buckets. */
+    size_t get_num_buckets(){
+        return num_buckets;
+    }
+
+    /* Returns the number of pages in use, primary and overflow. */
+    size_t get_num_pages(){
+        return pages.num_live_pages();
+    }
+
     /* Add a new bucket. */
     void add_bucket(){
-        HashBucket<T> new_bucket(overflow_limit);
-		buckets.push_back(new_bucket);
+		buckets.push_back(HashBucket<KEY, VAL>());
         num_buckets += 1;
     }
 
 	/* Split bucket at split_index. */
 	void split_bucket(){
 
-        /* Add a new bucket for the split. */
+        /* Add a new bucket for the split: its index is split_index plus the number of buckets at this level. */
         add_bucket();
 
-        // std::cout << "Before rehashing: " << "\n";
-        // buckets[split_index].print();
-        // buckets[buckets.size() - 1].print();
-
 		/* Rehash values for this split bucket. */
-		rehash(split_index, buckets.size() - 1);
-
-        // std::cout << "After rehashing: " << "\n";
-        // buckets[split_index].print();
-        // buckets[buckets.size() - 1].print();
+		rehash(split_index, num_buckets - 1);
 
-		/* Reset split index if reached the end for this level, otherwise increment. */
+		/* Increment the split index, resetting it and moving to the next level once every bucket of this level is split. */
+        split_index += 1;
 		if(split_index == split_demarcation(level)){
 			split_index = 0;
 			level += 1;
-		} else {
-			split_index += 1;
 		}
 	}
 
+    /* Remove the last bucket. Emptied segments of the bucket array are given back. */
+    void remove_bucket(){
+        assert(buckets.back().isEmpty());
+
+        buckets.pop_back();
+        num_buckets -= 1;
+    }
+
+    /* Undo the last split: merge the last bucket back into the bucket it was split from. */
+    void merge_bucket(){
+        assert(num_buckets > init_buckets);
+
+        /* Step the split pointer back, moving to the previous level if it was at the start of this one. */
+        if(split_index == 0){
+            level -= 1;
+            split_index = split_demarcation(level);
+        }
+        split_index -= 1;
+
+        /* The last bucket is the one split off from the bucket at the split pointer. */
+        HashBucket<KEY, VAL>& last = buckets[num_buckets - 1];
+        assert(num_buckets - 1 == split_index + split_demarcation(level));
+        while(!last.isEmpty()){
+            last.move_slot(pages, last.head, last.last_slot(pages), buckets[split_index]);
+        }
+
+        remove_bucket();
+    }
+
+    /*
+        Move every page in use below id num_live_pages(), by moving pages above it into free pages below it and
+        relinking their chains, then give back the pages above it. Takes time linear in the number of pages.
+    */
+    void compact_pages(){
+        size_t live = pages.num_live_pages();
+        std::vector<size_t> holes = pages.free_pages_below(live);
+
+        for(size_t i = 0; i < num_buckets; ++i){
+            size_t* link = &buckets[i].head;
+            while(*link != no_page){
+                if(*link >= live){
+                    size_t to = holes.back();
+                    holes.pop_back();
+                    pages.move_page(*link, to);
+                    *link = to;
+                }
+                link = &pages.next_page(*link);
+            }
+        }
+
+        assert(holes.empty());
+        pages.truncate(live);
+    }
+
 	/* Print the hash table. */
 	void print(){
 		std::cout << "Split pointer at bucket " << split_index << ".\n";
-		for(int i = 0; i < num_buckets; ++i){
+		for(size_t i = 0; i < num_buckets; ++i){
 			std::cout << "Bucket " << i << ": ";
-			buckets[i].print();
+			buckets[i].print(pages);
 		}
 	}
 };
+
+#endif
@@ -0,0 +1,823 @@
+/*
+    Persistent Linear Hashing in C++.
+    Author: Ameya Daigavane
+
+    A disk-backed variant of LinearHashTable, for trivially copyable keys and values, on POSIX systems.
+    Every bucket is a fixed-size primary page of the buckets file, at an offset computed from its index, so
+    no directory is needed; buckets which overflow chain further pages from a separate overflow file.
+    The level, split pointer and initial number of buckets live in a header page at the start of the
+    buckets file. Pages are read and written through an LRU buffer pool of a fixed number of pages, so
+    tables can be much larger than memory, and a lookup reads about one page while the load factor is
+    kept below max_load.
+    Hasher must return the same values in every process opening the table: the default MixHash does
+    for integral keys.
+
+    Pages linking to other pages are written in an order that lets a crash of the process be recovered from:
+    - A new overflow page is written to its file before the page linking to it.
+    - A split writes the new bucket first, then the header counting it, and only then rewrites the old
+      bucket, on fresh overflow pages; until then, the old bucket also holds the keys that moved.
+    - A remove writes the page receiving the last pair of the chain before the page losing it, so a pair
+      may be left in two pages, but never in none.
+    Reopening a table that was not synced rescans every chain, dropping such leftover pairs, and rebuilds
+    the key count and the free list of overflow pages. Changes made since the last sync may be lost.
+*/
+
+#ifndef PERSISTENT_LINEAR_HASHING_HPP
+#define PERSISTENT_LINEAR_HASHING_HPP
+
+#include <string>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <stdexcept>
+#include <type_traits>
+#include "../ExtendibleHashTable/hashers.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Identifies a persistent linear hash table file. */
+const uint64_t persistent_linear_magic = 0x4c48545045525354ull;
+
+/* Marks the end of a chain of overflow pages, and of the free list. */
+const uint64_t no_overflow_page = (uint64_t) -1;
+
+/* Layout of the header page, page 0 of the buckets file. */
+struct PersistentLinearHeader {
+    uint64_t magic;
+    uint64_t key_size;
+    uint64_t val_size;
+    uint64_t num_slots;
+    uint64_t page_size;
+
+    uint64_t init_buckets;
+    uint64_t level;
+    uint64_t split_index;
+    uint64_t num_keys;
+    double max_load;
+
+    /* Pages carved out of the overflow file so far, how many of them are free, and the first free one. */
+    uint64_t num_overflow_pages;
+    uint64_t num_free_overflow;
+    uint64_t free_overflow;
+
+    /* 1 if no change was made since the table was last synced. */
+    uint64_t clean;
+};
+
+/* Layout of the start of every primary and overflow page. The keys and values follow at fixed offsets. */
+struct PersistentLinearPage {
+    uint64_t num_keys;
+
+    /* Next overflow page of the chain, or of the free list. */
+    uint64_t next;
+};
+
+/*
+    LRU cache of fixed-size pages of files, read and written with pread and pwrite.
+    Pages stay in memory while pinned, and dirty pages are only written back when evicted or flushed.
+*/
+class BufferPool {
+    struct Frame {
+        int fd;
+        uint64_t page_no;
+        size_t pins;
+        bool dirty;
+        std::list<size_t>::iterator lru_pos;
+    };
+
+    size_t page_size;
+    std::unique_ptr<char[]> memory;
+    std::vector<Frame> frames;
+
+    /* Frame indices, most recently used first. */
+    std::list<size_t> lru;
+    std::unordered_map<uint64_t, size_t> resident;
+    size_t num_reads;
+    size_t num_writes;
+
+    static uint64_t page_key(int fd, uint64_t page_no){
+        return ((uint64_t) fd << 48) | page_no;
+    }
+
+    char* frame_data(size_t frame){
+        return memory.get() + frame * page_size;
+    }
+
+    void write_frame(size_t frame){
+        Frame& f = frames[frame];
+        const char* data = frame_data(frame);
+        size_t done = 0;
+        while(done < page_size){
+            ssize_t n = pwrite(f.fd, data + done, page_size - done, f.page_no * page_size + done);
+            if(n <= 0){
+                throw std::runtime_error("Cannot write table page.");
+            }
+            done += n;
+        }
+        f.dirty = false;
+        num_writes += 1;
+    }
+
+    void read_frame(size_t frame){
+        Frame& f = frames[frame];
+        char* data = frame_data(frame);
+        size_t done = 0;
+        while(done < page_size){
+            ssize_t n = pread(f.fd, data + done, page_size - done, f.page_no * page_size + done);
+            if(n <= 0){
+                throw std::runtime_error("Cannot read table page.");
+            }
+            done += n;
+        }
+        num_reads += 1;
+    }
+
+    public:
+    BufferPool(size_t page_size, size_t num_frames){
+        assert(num_frames >= 4);
+        this -> page_size = page_size;
+        this -> memory.reset(new char[page_size * num_frames]());
+        this -> num_reads = 0;
+        this -> num_writes = 0;
+
+        frames.resize(num_frames);
+        for(size_t i = 0; i < num_frames; ++i){
+            frames[i].fd = -1;
+            frames[i].pins = 0;
+            frames[i].dirty = false;
+            frames[i].lru_pos = lru.insert(lru.end(), i);
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    /*
+        Pin page page_no of file fd in memory and return its contents, reading it unless it is cached.
+        A fresh page is about to be overwritten entirely, so it is not read.
+    */
+    char* pin(int fd, uint64_t page_no, bool fresh = false){
+        std::unordered_map<uint64_t, size_t>::iterator found = resident.find(page_key(fd, page_no));
+        size_t frame;
+
+        if(found != resident.end()){
+            frame = found -> second;
+        } else {
+
+            /* Evict the least recently used unpinned page. */
+            std::list<size_t>::reverse_iterator victim = lru.rbegin();
+            while(victim != lru.rend() && frames[*victim].pins > 0){
+                ++victim;
+            }
+            if(victim == lru.rend()){
+                throw std::runtime_error("All buffer pool pages are pinned.");
+            }
+
+            frame = *victim;
+            if(frames[frame].dirty){
+                write_frame(frame);
+            }
+            if(frames[frame].fd != -1){
+                resident.erase(page_key(frames[frame].fd, frames[frame].page_no));
+            }
+
+            frames[frame].fd = fd;
+            frames[frame].page_no = page_no;
+            if(fresh){
+                memset(frame_data(frame), 0, page_size);
+            } else {
+                read_frame(frame);
+            }
+            resident[page_key(fd, page_no)] = frame;
+        }
+
+        lru.splice(lru.begin(), lru, frames[frame].lru_pos);
+        frames[frame].pins += 1;
+        frames[frame].dirty |= fresh;
+        return frame_data(frame);
+    }
+
+    /* Release a page pinned by pin(), marking it dirty if it was modified. */
+    void unpin(int fd, uint64_t page_no, bool dirty){
+        Frame& f = frames[resident.at(page_key(fd, page_no))];
+        assert(f.pins > 0);
+        f.pins -= 1;
+        f.dirty |= dirty;
+    }
+
+    /* Write page page_no of file fd back now if it is cached and dirty, to order it before later writes. */
+    void write_back(int fd, uint64_t page_no){
+        std::unordered_map<uint64_t, size_t>::iterator found = resident.find(page_key(fd, page_no));
+        if(found != resident.end() && frames[found -> second].dirty){
+            write_frame(found -> second);
+        }
+    }
+
+    /* Write all dirty pages back. */
+    void flush(){
+        for(size_t i = 0; i < frames.size(); ++i){
+            if(frames[i].dirty){
+                write_frame(i);
+            }
+        }
+    }
+
+    /* Number of pages read from and written to the files so far. */
+    size_t get_num_reads(){
+        return num_reads;
+    }
+
+    size_t get_num_writes(){
+        return num_writes;
+    }
+};
+
+template <typename KEY, typename VAL, typename Hasher = MixHash<KEY>>
+class PersistentLinearHashTable {
+
+    static_assert(std::is_trivially_copyable<KEY>::value && std::is_trivially_copyable<VAL>::value,
+                  "PersistentLinearHashTable needs trivially copyable keys and values.");
+
+    std::string path;
+    int buckets_fd;
+    int overflow_fd;
+    size_t num_slots;
+    size_t page_size;
+    size_t keys_offset;
+    size_t vals_offset;
+
+    /* In-memory copy of the header page, written back by sync(). */
+    PersistentLinearHeader meta;
+    std::unique_ptr<BufferPool> buffers;
+    Hasher hasher;
+
+    /* A page is named by its file, and its number in that file. */
+    struct PageRef {
+        int fd;
+        uint64_t page_no;
+    };
+
+    PageRef primary_page(size_t index){
+        PageRef ref = {buckets_fd, index + 1};
+        return ref;
+    }
+
+    PageRef overflow_page(uint64_t id){
+        PageRef ref = {overflow_fd, id};
+        return ref;
+    }
+
+    char* pin(PageRef ref, bool fresh = false){
+        return buffers -> pin(ref.fd, ref.page_no, fresh);
+    }
+
+    void unpin(PageRef ref, bool dirty){
+        buffers -> unpin(ref.fd, ref.page_no, dirty);
+    }
+
+    /* Release a modified page, writing it to its file right away. */
+    void write_through(PageRef ref){
+        buffers -> unpin(ref.fd, ref.page_no, true);
+        buffers -> write_back(ref.fd, ref.page_no);
+    }
+
+    static PersistentLinearPage* page_header(char* data){
+        return reinterpret_cast<PersistentLinearPage*>(data);
+    }
+
+    KEY* page_keys(char* data){
+        return reinterpret_cast<KEY*>(data + keys_offset);
+    }
+
+    VAL* page_vals(char* data){
+        return reinterpret_cast<VAL*>(data + vals_offset);
+    }
+
+    size_t hash(const KEY& key){
+        return hasher(key);
+    }
+
+    size_t hash_level(size_t hash_val, size_t level){
+        return hash_val % split_demarcation(level);
+    }
+
+    size_t split_demarcation(size_t level){
+        return ((size_t) 1 << level) * meta.init_buckets;
+    }
+
+    /* Index of the bucket for this hash value: buckets before the split index have already been split. */
+    size_t get_bucket_index(size_t hash_val){
+        size_t index = hash_level(hash_val, meta.level);
+
+        if(index < meta.split_index){
+            index = hash_level(hash_val, meta.level + 1);
+        }
+        return index;
+    }
+
+    /* Write the header page straight to the file. */
+    void write_header(){
+        std::unique_ptr<char[]> data(new char[page_size]());
+        memcpy(data.get(), &meta, sizeof(PersistentLinearHeader));
+        if(pwrite(buckets_fd, data.get(), page_size, 0) != (ssize_t) page_size){
+            throw std::runtime_error("Cannot write table header.");
+        }
+    }
+
+    void close_files(){
+        if(buckets_fd >= 0){
+            close(buckets_fd);
+        }
+        if(overflow_fd >= 0){
+            close(overflow_fd);
+        }
+    }
+
+    /* Mark the table on disk as modified, before the first change after opening or syncing. */
+    void begin_write(){
+        if(meta.clean){
+            meta.clean = 0;
+            write_header();
+        }
+    }
+
+    /* Take an overflow page off the free list, or carve a new one out of the overflow file. */
+    uint64_t allocate_overflow(){
+        uint64_t id = meta.free_overflow;
+        if(id != no_overflow_page){
+            PageRef ref = overflow_page(id);
+            meta.free_overflow = page_header(pin(ref)) -> next;
+            meta.num_free_overflow -= 1;
+            unpin(ref, false);
+        } else {
+            id = meta.num_overflow_pages;
+            meta.num_overflow_pages += 1;
+        }
+        return id;
+    }
+
+    /* Put an overflow page on the free list. */
+    void release_overflow(uint64_t id){
+        PageRef ref = overflow_page(id);
+        char* data = pin(ref, true);
+        page_header(data) -> num_keys = 0;
+        page_header(data) -> next = meta.free_overflow;
+        unpin(ref, true);
+        meta.free_overflow = id;
+        meta.num_free_overflow += 1;
+    }
+
+    /* Pages of the chain of bucket index, primary page first. */
+    std::vector<PageRef> chain(size_t index){
+        std::vector<PageRef> pages(1, primary_page(index));
+        while(true){
+            uint64_t next = page_header(pin(pages.back())) -> next;
+            unpin(pages.back(), false);
+            if(next == no_overflow_page){
+                return pages;
+            }
+            pages.push_back(overflow_page(next));
+        }
+    }
+
+    /*
+        Replace the contents of bucket index with the given pairs, chaining overflow pages as needed.
+        The chain is written from its end, every page before the one linking to it, and the primary page last.
+    */
+    void write_bucket(size_t index, const std::vector<KEY>& keys, const std::vector<VAL>& vals){
+        size_t num_pages = keys.empty() ? 1 : (keys.size() + num_slots - 1) / num_slots;
+        uint64_t next = no_overflow_page;
+
+        for(size_t p = num_pages; p-- > 0;){
+            PageRef ref = (p == 0) ? primary_page(index) : overflow_page(allocate_overflow());
+            char* data = pin(ref, true);
+            size_t first = p * num_slots;
+            size_t used = (keys.size() - first < num_slots) ? keys.size() - first : num_slots;
+            for(size_t i = 0; i < used; ++i){
+                page_keys(data)[i] = keys[first + i];
+                page_vals(data)[i] = vals[first + i];
+            }
+            page_header(data) -> num_keys = used;
+            page_header(data) -> next = next;
+            write_through(ref);
+            next = ref.page_no;
+        }
+    }
+
+    /* Split the bucket at the split index, moving the pairs whose higher level hash differs to a new bucket. */
+    void split_bucket(){
+        size_t index1 = meta.split_index;
+        size_t index2 = index1 + split_demarcation(meta.level);
+
+        /* Read the chain into memory, and free its overflow pages for the two new chains to reuse. */
+        std::vector<KEY> keys1, keys2;
+        std::vector<VAL> vals1, vals2;
+        std::vector<PageRef> pages = chain(index1);
+        for(size_t p = 0; p < pages.size(); ++p){
+            char* data = pin(pages[p]);
+            for(size_t i = 0; i < page_header(data) -> num_keys; ++i){
+                KEY key = page_keys(data)[i];
+                if(hash_level(hash(key), meta.level + 1) == index1){
+                    keys1.push_back(key);
+                    vals1.push_back(page_vals(data)[i]);
+                } else {
+                    keys2.push_back(key);
+                    vals2.push_back(page_vals(data)[i]);
+                }
+            }
+            unpin(pages[p], false);
+        }
+
+        /* The new bucket is counted in the header only once it is written. */
+        write_bucket(index2, keys2, vals2);
+        meta.split_index += 1;
+        if(meta.split_index == split_demarcation(meta.level)){
+            meta.level += 1;
+            meta.split_index = 0;
+        }
+        write_header();
+
+        /* The old chain is freed once the rewritten primary page no longer links to it. */
+        write_bucket(index1, keys1, vals1);
+        for(size_t p = pages.size() - 1; p > 0; --p){
+            release_overflow(pages[p].page_no);
+        }
+    }
+
+    /*
+        Bring a table that was not synced back to a consistent state. Every chain is read, up to any link to a
+        page beyond the overflow file or already seen, and its pairs are kept unless they belong to another
+        bucket or were seen earlier in the chain. Chains which lost pairs, or have a page with free slots
+        before their end, are rewritten. Overflow pages in no chain make up the new free list.
+    */
+    void recover(){
+        struct stat info;
+        if(fstat(overflow_fd, &info) != 0){
+            throw std::runtime_error("Cannot read the size of the overflow file at " + path + ".");
+        }
+        meta.num_overflow_pages = info.st_size / page_size;
+        std::vector<bool> in_chain(meta.num_overflow_pages, false);
+
+        std::vector<size_t> rewrite_index;
+        std::vector<std::vector<KEY>> rewrite_keys;
+        std::vector<std::vector<VAL>> rewrite_vals;
+        std::vector<std::vector<uint64_t>> rewrite_pages;
+        meta.num_keys = 0;
+
+        for(size_t index = 0; index < get_num_buckets(); ++index){
+            std::vector<KEY> keys;
+            std::vector<VAL> vals;
+            std::vector<uint64_t> pages;
+            std::unordered_set<KEY, Hasher> seen;
+            bool rewrite = false;
+
+            PageRef ref = primary_page(index);
+            while(true){
+                char* data = pin(ref);
+                size_t size = page_header(data) -> num_keys;
+                uint64_t next = page_header(data) -> next;
+                if(size > num_slots){
+                    size = num_slots;
+                    rewrite = true;
+                }
+                for(size_t i = 0; i < size; ++i){
+                    KEY key = page_keys(data)[i];
+                    if(get_bucket_index(hash(key)) != index || !seen.insert(key).second){
+                        rewrite = true;
+                        continue;
+                    }
+                    keys.push_back(key);
+                    vals.push_back(page_vals(data)[i]);
+                }
+                unpin(ref, false);
+
+                if(next == no_overflow_page){
+                    break;
+                }
+                bool dangling = next >= in_chain.size() || in_chain[next];
+                if(dangling || size < num_slots){
+                    rewrite = true;
+                }
+                if(dangling){
+                    break;
+                }
+                in_chain[next] = true;
+                pages.push_back(next);
+                ref = overflow_page(next);
+            }
+
+            meta.num_keys += keys.size();
+            if(rewrite){
+                rewrite_index.push_back(index);
+                rewrite_keys.push_back(keys);
+                rewrite_vals.push_back(vals);
+                rewrite_pages.push_back(pages);
+            }
+        }
+
+        meta.free_overflow = no_overflow_page;
+        meta.num_free_overflow = 0;
+        for(uint64_t id = meta.num_overflow_pages; id-- > 0;){
+            if(!in_chain[id]){
+                release_overflow(id);
+            }
+        }
+
+        for(size_t b = 0; b < rewrite_index.size(); ++b){
+            write_bucket(rewrite_index[b], rewrite_keys[b], rewrite_vals[b]);
+            for(size_t p = 0; p < rewrite_pages[b].size(); ++p){
+                release_overflow(rewrite_pages[b][p]);
+            }
+        }
+
+        sync();
+    }
+
+    /* Check the header of the files, or lay out a new table in them. The files are closed by the caller if this throws. */
+    void open_table(size_t num_buckets, size_t num_slots, size_t pool_pages){
+        if(num_slots == 0){
+            num_slots = (4096 - sizeof(PersistentLinearPage)) / (sizeof(KEY) + sizeof(VAL));
+        }
+
+        struct stat info;
+        if(fstat(buckets_fd, &info) != 0){
+            throw std::runtime_error("Cannot read the size of the buckets file at " + path + ".");
+        }
+        bool exists = info.st_size > 0;
+
+        if(exists){
+            if(pread(buckets_fd, &meta, sizeof(PersistentLinearHeader), 0) != (ssize_t) sizeof(PersistentLinearHeader)){
+                throw std::runtime_error("Cannot read table header at " + path + ".");
+            }
+            if(meta.magic != persistent_linear_magic || meta.key_size != sizeof(KEY) || meta.val_size != sizeof(VAL)){
+                throw std::runtime_error("Table file at " + path + " does not match the key and value types.");
+            }
+
+            /* The layout is fixed when the table is created. */
+            num_slots = meta.num_slots;
+        } else {
+            assert(num_buckets > 0);
+            memset(&meta, 0, sizeof(PersistentLinearHeader));
+            meta.key_size = sizeof(KEY);
+            meta.val_size = sizeof(VAL);
+            meta.num_slots = num_slots;
+            meta.init_buckets = num_buckets;
+            meta.max_load = 0.8;
+            meta.free_overflow = no_overflow_page;
+        }
+
+        /* Keys follow the page header, values follow the keys, each aligned for its type. */
+        this -> num_slots = num_slots;
+        keys_offset = sizeof(PersistentLinearPage);
+        keys_offset = (keys_offset + alignof(KEY) - 1) / alignof(KEY) * alignof(KEY);
+        vals_offset = keys_offset + num_slots * sizeof(KEY);
+        vals_offset = (vals_offset + alignof(VAL) - 1) / alignof(VAL) * alignof(VAL);
+        page_size = vals_offset + num_slots * sizeof(VAL);
+        page_size = (page_size + 63) / 64 * 64;
+        if(page_size < sizeof(PersistentLinearHeader)){
+            page_size = (sizeof(PersistentLinearHeader) + 63) / 64 * 64;
+        }
+        if(exists && page_size != meta.page_size){
+            throw std::runtime_error("Table file at " + path + " has an unexpected page size.");
+        }
+        meta.page_size = page_size;
+
+        buffers.reset(new BufferPool(page_size, pool_pages));
+
+        if(exists){
+            if(!meta.clean){
+                recover();
+            }
+            return;
+        }
+
+        std::vector<KEY> no_keys;
+        std::vector<VAL> no_vals;
+        for(size_t i = 0; i < num_buckets; ++i){
+            write_bucket(i, no_keys, no_vals);
+        }
+
+        /* The magic number goes in last, so that a half-created table is never opened. */
+        meta.magic = persistent_linear_magic;
+        sync();
+    }
+
+    public:
+    /*
+        Opens the table stored at path (as path + ".buckets" and path + ".overflow"), creating it if it does not exist.
+        num_slots = 0 fits as many slots as possible into 4 KiB pages. pool_pages is the number of pages
+        cached in memory, and may differ every time the table is opened.
+    */
+    PersistentLinearHashTable(const std::string& path, size_t num_buckets = 10, size_t num_slots = 0, size_t pool_pages = 256){
+        this -> path = path;
+
+        buckets_fd = open((path + ".buckets").c_str(), O_RDWR | O_CREAT, 0644);
+        overflow_fd = open((path + ".overflow").c_str(), O_RDWR | O_CREAT, 0644);
+        try {
+            if(buckets_fd < 0 || overflow_fd < 0){
+                throw std::runtime_error("Cannot open table files at " + path + ".");
+            }
+            open_table(num_buckets, num_slots, pool_pages);
+        } catch(...){
+            close_files();
+            throw;
+        }
+    }
+
+    /* Writes everything back and closes the files. Errors cannot be reported here: call sync() first to see them. */
+    ~PersistentLinearHashTable(){
+        try {
+            sync();
+        } catch(const std::runtime_error&){
+        }
+        close_files();
+    }
+
+    PersistentLinearHashTable(const PersistentLinearHashTable&) = delete;
+    PersistentLinearHashTable& operator=(const PersistentLinearHashTable&) = delete;
+
+    /*
+        Writes all cached changes and the header back to the files, and flushes them to disk, so that they survive
+        power loss. A table which was changed after its last sync, and not closed, is recovered when opened again:
+        it holds every key synced and left untouched since, each once, while later changes may or may not be kept.
+    */
+    void sync(){
+        buffers -> flush();
+        if(fsync(overflow_fd) != 0 || fsync(buckets_fd) != 0){
+            throw std::runtime_error("Cannot flush table files at " + path + ".");
+        }
+        meta.clean = 1;
+        write_header();
+        if(fsync(buckets_fd) != 0){
+            throw std::runtime_error("Cannot flush table header at " + path + ".");
+        }
+    }
+
+    /* Split buckets whenever the load factor exceeds max_load. Kept across reopening. */
+    void set_max_load(double max_load){
+        assert(max_load > 0);
+        begin_write();
+        meta.max_load = max_load;
+    }
+
+    /* Insert into the hash table, overwriting the value if the key is already present. */
+    void insert(KEY key, VAL val){
+        begin_write();
+
+        /* Look for the key down the chain, keeping its last page pinned. */
+        PageRef ref = primary_page(get_bucket_index(hash(key)));
+        char* data = pin(ref);
+        while(true){
+            PersistentLinearPage* p = page_header(data);
+            KEY* keys = page_keys(data);
+            for(size_t i = 0; i < p -> num_keys; ++i){
+                if(keys[i] == key){
+                    page_vals(data)[i] = val;
+                    unpin(ref, true);
+                    return;
+                }
+            }
+            if(p -> next == no_overflow_page){
+                break;
+            }
+            PageRef next = overflow_page(p -> next);
+            unpin(ref, false);
+            ref = next;
+            data = pin(ref);
+        }
+
+        /* Only the last page of a chain has free slots. A new page is written before the link to it. */
+        if(page_header(data) -> num_keys == num_slots){
+            uint64_t id = allocate_overflow();
+            PageRef added = overflow_page(id);
+            char* added_data = pin(added, true);
+            page_keys(added_data)[0] = key;
+            page_vals(added_data)[0] = val;
+            page_header(added_data) -> num_keys = 1;
+            page_header(added_data) -> next = no_overflow_page;
+            write_through(added);
+
+            page_header(data) -> next = id;
+        } else {
+            size_t slot = page_header(data) -> num_keys;
+            page_keys(data)[slot] = key;
+            page_vals(data)[slot] = val;
+            page_header(data) -> num_keys = slot + 1;
+        }
+        unpin(ref, true);
+        meta.num_keys += 1;
+
+        if(get_load_factor() > meta.max_load){
+            split_bucket();
+        }
+    }
+
+    /* Searches for the key in the hash table. Returns true and sets val if the key is present. */
+    bool find(KEY key, VAL& val){
+        PageRef ref = primary_page(get_bucket_index(hash(key)));
+        while(true){
+            char* data = pin(ref);
+            PersistentLinearPage* p = page_header(data);
+            KEY* keys = page_keys(data);
+            for(size_t i = 0; i < p -> num_keys; ++i){
+                if(keys[i] == key){
+                    val = page_vals(data)[i];
+                    unpin(ref, false);
+                    return true;
+                }
+            }
+            uint64_t next = p -> next;
+            unpin(ref, false);
+            if(next == no_overflow_page){
+                return false;
+            }
+            ref = overflow_page(next);
+        }
+    }
+
+    /* Checks if key is present in the hash table. */
+    bool count(KEY key){
+        VAL val;
+        return find(key, val);
+    }
+
+    /* Delete a key from the hash table, by moving the last pair of its chain into its slot. Returns true if it was present. */
+    bool remove(KEY key){
+        std::vector<PageRef> pages = chain(get_bucket_index(hash(key)));
+
+        for(size_t p = 0; p < pages.size(); ++p){
+            char* data = pin(pages[p]);
+            KEY* keys = page_keys(data);
+            for(size_t i = 0; i < page_header(data) -> num_keys; ++i){
+                if(!(keys[i] == key)){
+                    continue;
+                }
+                begin_write();
+
+                char* last = data;
+                if(p != pages.size() - 1){
+                    last = pin(pages.back());
+                }
+                size_t last_slot = page_header(last) -> num_keys - 1;
+                keys[i] = page_keys(last)[last_slot];
+                page_vals(data)[i] = page_vals(last)[last_slot];
+
+                /* The pair moved to another page is written there before it leaves the last page. */
+                if(p != pages.size() - 1){
+                    write_through(pages[p]);
+                    page_header(last) -> num_keys = last_slot;
+                    unpin(pages.back(), true);
+                } else {
+                    page_header(last) -> num_keys = last_slot;
+                    unpin(pages[p], true);
+                }
+
+                /* Unlink an emptied overflow page from its chain, before it goes on the free list. */
+                if(last_slot == 0 && pages.size() > 1){
+                    PageRef prev = pages[pages.size() - 2];
+                    page_header(pin(prev)) -> next = no_overflow_page;
+                    write_through(prev);
+                    release_overflow(pages.back().page_no);
+                }
+
+                meta.num_keys -= 1;
+                return true;
+            }
+            unpin(pages[p], false);
+        }
+        return false;
+    }
+
+    /* Returns the number of keys over the number of slots in the primary pages of all buckets. */
+    double get_load_factor(){
+        return meta.num_keys / ((double) get_num_buckets() * num_slots);
+    }
+
+    /* Returns the total number of key-value pairs. */
+    size_t size(){
+        return meta.num_keys;
+    }
+
+    size_t get_num_buckets(){
+        return split_demarcation(meta.level) + meta.split_index;
+    }
+
+    /* Returns the number of overflow pages in use. */
+    size_t get_num_overflow_pages(){
+        return meta.num_overflow_pages - meta.num_free_overflow;
+    }
+
+    /* Returns the number of pages read from disk since the table was opened. */
+    size_t get_page_reads(){
+        return buffers -> get_num_reads();
+    }
+};
+
+#endif
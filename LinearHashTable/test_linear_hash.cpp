@@ -6,18 +6,32 @@
 #include <iostream>
 #include <cstdlib>
 #include <cassert>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "linear_hashing.hpp"
+#include "concurrent_linear_hashing.hpp"
+#include "persistent_linear_hashing.hpp"
 
 int main(){
-	LinearHashTable<int> hash_table(10);
+	LinearHashTable<int, int> hash_table(10);
 
     hash_table.print();
     std::cout << "\n";
 
-    /* Insert random keys. */
+    /* Insert random keys, remembering the last value inserted for each. */
     int num_keys = 1000;
+    std::vector<int> values(1000, -1);
     for(int i = 0; i < num_keys; ++i){
-        hash_table.insert(rand() % 1000);
+        int key = rand() % 1000;
+        hash_table.insert(key, i);
+        values[key] = i;
     }
 
 	hash_table.print();
@@ -25,29 +39,402 @@ int main(){
 
     std::cout << "Insertion tests passed!" << "\n";
 
-    /* Search some keys. */
-    assert(hash_table.count(449) == false);
-    assert(hash_table.count(439) == true);
-    assert(hash_table.count(278) == false);
-    assert(hash_table.count(176) == true);
+    /* Search all keys: keys inserted more than once keep their last value. */
+    size_t distinct = 0;
+    for(int key = 0; key < 1000; ++key){
+        assert(hash_table.count(key) == (values[key] != -1));
+        int* val = hash_table.find(key);
+        assert((val != NULL) == (values[key] != -1));
+        assert(val == NULL || *val == values[key]);
+        distinct += (values[key] != -1);
+    }
+    assert(hash_table.count(-1) == false);
+    assert(hash_table.count(1000) == false);
+    assert(hash_table.size() == distinct);
 
     std::cout << "Search tests passed!" << "\n";
 
-    /* Delete some keys. */
-    hash_table.del(176);
-    assert(hash_table.count(176) == false);
-    hash_table.del(439);
-    assert(hash_table.count(439) == true);
-    hash_table.del(439);
-    assert(hash_table.count(439) == true);
-    hash_table.del(439);
-    assert(hash_table.count(439) == false);
+    /* Delete every present key with an even value. */
+    for(int key = 0; key < 1000; ++key){
+        if(values[key] != -1 && values[key] % 2 == 0){
+            hash_table.del(key);
+            assert(hash_table.count(key) == false);
+            values[key] = -1;
+            distinct -= 1;
+        }
+    }
+    for(int key = 0; key < 1000; ++key){
+        assert(hash_table.count(key) == (values[key] != -1));
+    }
+    assert(hash_table.size() == distinct);
 
     hash_table.print();
     std::cout << "\n";
 
     std::cout << "Deletion tests passed!" << "\n";
 
+    /* 64-bit and string keys, with long overflow chains drawn from the page pool. */
+    LinearHashTable<unsigned long long, int> wide(4, 2);
+    for(int i = 0; i < 20000; ++i){
+        wide.insert((unsigned long long) i << 40, i);
+    }
+    for(int i = 0; i < 20000; i += 2){
+        wide.del((unsigned long long) i << 40);
+    }
+    for(int i = 0; i < 20000; ++i){
+        int* val = wide.find((unsigned long long) i << 40);
+        assert((val != NULL) == (i % 2 == 1));
+        assert(val == NULL || *val == i);
+    }
+    assert(wide.size() == 10000);
+
+    /* Freed pages are reused before new ones are carved. */
+    size_t pages_used = wide.get_num_pages();
+    for(int i = 0; i < 20000; i += 2){
+        wide.insert((unsigned long long) i << 40, i);
+    }
+    assert(wide.get_num_pages() <= pages_used + wide.get_num_buckets());
+
+    LinearHashTable<std::string, std::string> named(1, 4);
+    for(int i = 0; i < 3000; ++i){
+        named.insert("key" + std::to_string(i), std::to_string(i));
+    }
+    for(int i = 0; i < 3000; ++i){
+        assert(*named.find("key" + std::to_string(i)) == std::to_string(i));
+    }
+    assert(named.count("key3000") == false);
+
+    std::cout << "Map tests passed!" << "\n";
+
+    /* Controlled splitting keeps the load factor at the threshold, whatever the key distribution. */
+    LinearHashTable<int, int> controlled(8, 4);
+    controlled.set_max_load(0.75);
+    for(int i = 0; i < 50000; ++i){
+        controlled.insert(i * 17, i);
+        assert(controlled.get_load_factor() <= 0.75);
+    }
+    assert(controlled.get_load_factor() > 0.7);
+    assert(controlled.get_num_buckets() == (size_t) (50000 / (0.75 * 4)) + 1);
+    for(int i = 0; i < 50000; ++i){
+        assert(*controlled.find(i * 17) == i);
+    }
+
+    /* Splits move pairs in place, returning emptied pages: each bucket keeps at most one partially filled page. */
+    for(int i = 50000; i < 60000; ++i){
+        controlled.insert(i * 17, i);
+    }
+    assert(controlled.get_num_pages() <= controlled.get_num_buckets() + controlled.size() / 4);
+    for(int i = 0; i < 60000; ++i){
+        assert(controlled.count(i * 17) == true);
+        assert(controlled.count(i * 17 + 1) == false);
+    }
+
+    std::cout << "Split policy tests passed!" << "\n";
+
+    /* After a burst, deletes must merge buckets back and return pages, and the table must grow again. */
+    LinearHashTable<int, int> burst(4, 4);
+    burst.set_max_load(0.8);
+    burst.set_min_load(0.3);
+    for(int i = 0; i < 100000; ++i){
+        burst.insert(i, i);
+    }
+    size_t peak_buckets = burst.get_num_buckets();
+    size_t peak_pages = burst.get_num_pages();
+
+    for(int i = 0; i < 100000; ++i){
+        if(i % 100 != 0){
+            burst.del(i);
+            assert(burst.get_load_factor() >= 0.3 || burst.get_num_buckets() == 4);
+        }
+    }
+    assert(burst.size() == 1000);
+    assert(burst.get_num_buckets() < peak_buckets / 30);
+    assert(burst.get_num_pages() < peak_pages / 30);
+    for(int i = 0; i < 100000; ++i){
+        int* val = burst.find(i);
+        assert((val != NULL) == (i % 100 == 0));
+        assert(val == NULL || *val == i);
+    }
+
+    for(int i = 0; i < 100000; ++i){
+        burst.insert(i, -i);
+    }
+    assert(burst.size() == 100000);
+    for(int i = 0; i < 100000; ++i){
+        assert(*burst.find(i) == -i);
+    }
+
+    /* Deleting everything shrinks the table back to its initial buckets. */
+    for(int i = 0; i < 100000; ++i){
+        burst.del(i);
+    }
+    assert(burst.size() == 0 && burst.get_num_buckets() == 4 && burst.get_num_pages() == 0);
+
+    /* Removed values are released at once, including those moved around by splits and merges. */
+    std::shared_ptr<int> shared_value(new int(7));
+    LinearHashTable<int, std::shared_ptr<int>> sharers(2, 4);
+    for(int i = 0; i < 100; ++i){
+        sharers.insert(i, shared_value);
+    }
+    for(int i = 0; i < 100; i += 2){
+        sharers.del(i);
+    }
+    assert(shared_value.use_count() == 51);
+    for(int i = 1; i < 100; i += 2){
+        sharers.del(i);
+    }
+    assert(shared_value.use_count() == 1);
+
+    std::cout << "Contraction tests passed!" << "\n";
+
+    /* Buckets live in segments of doubling sizes: growing and shrinking across many segment boundaries keeps every pair. */
+    int initial_buckets[] = {1, 3, 10};
+    for(int t = 0; t < 3; ++t){
+        LinearHashTable<long long, int> segmented(initial_buckets[t], 2);
+        segmented.set_max_load(0.9);
+        segmented.set_min_load(0.4);
+        for(int round = 0; round < 3; ++round){
+            for(int i = 0; i < 30000; ++i){
+                segmented.insert((long long) i * 7919, i);
+            }
+            assert(segmented.get_num_buckets() > 10000);
+            for(int i = 0; i < 30000; ++i){
+                assert(*segmented.find((long long) i * 7919) == i);
+            }
+            for(int i = 0; i < 30000; ++i){
+                if(i % (round + 2) != 0){
+                    segmented.del((long long) i * 7919);
+                }
+            }
+            for(int i = 0; i < 30000; ++i){
+                assert(segmented.count((long long) i * 7919) == (i % (round + 2) == 0));
+            }
+        }
+    }
+
+    std::cout << "Segmented directory tests passed!" << "\n";
+
+    /* Pages wider than one fingerprint group, and keys which all share one fingerprint, must still be found exactly. */
+    size_t page_widths[] = {20, 64};
+    for(int t = 0; t < 2; ++t){
+        LinearHashTable<int, int> paged(2, page_widths[t]);
+        paged.set_max_load(4.0);
+        LinearHashTable<size_t, int, IdentityHash<size_t>> colliding(1, page_widths[t]);
+        for(int i = 0; i < 3000; ++i){
+            paged.insert(i * 3, i);
+            colliding.insert((size_t) i, i);
+        }
+        for(int i = 0; i < 3000; i += 3){
+            paged.del(i * 3);
+            colliding.del((size_t) i);
+        }
+        for(int i = 0; i < 3000; ++i){
+            assert(paged.count(i * 3) == (i % 3 != 0));
+            assert(paged.count(i * 3 + 1) == false);
+            int* val = colliding.find((size_t) i);
+            assert((val != NULL) == (i % 3 != 0));
+            assert(val == NULL || *val == i);
+        }
+        assert(paged.size() == 2000 && colliding.size() == 2000);
+    }
+
+    std::cout << "Fingerprint probing tests passed!" << "\n";
+
+    /* Writers on disjoint key ranges race with lock-free readers, and with the splits their inserts trigger. */
+    ConcurrentLinearHashTable<int, int> clht(1, 4);
+    int num_threads = 4;
+    int keys_per_thread = 20000;
+    std::vector<std::thread> threads;
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&clht, t, keys_per_thread](){
+            for(int i = 0; i < keys_per_thread; ++i){
+                int key = t * keys_per_thread + i;
+                clht.insert(key, key * 2);
+
+                /* Keys inserted earlier by this thread must stay visible throughout. */
+                int val = 0;
+                int earlier = t * keys_per_thread + i / 2;
+                assert(clht.find(earlier, val) == true);
+                assert(val == earlier * 2);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+    assert(clht.size() == (size_t) (num_threads * keys_per_thread));
+    assert(clht.get_load_factor() <= 0.8);
+
+    threads.clear();
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&clht, t, keys_per_thread](){
+            for(int i = 0; i < keys_per_thread; i += 2){
+                assert(clht.remove(t * keys_per_thread + i) == true);
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    for(int key = 0; key < num_threads * keys_per_thread; ++key){
+        assert(clht.count(key) == (key % 2 == 1));
+    }
+    assert(clht.remove(0) == false);
+    assert(clht.size() == (size_t) (num_threads * keys_per_thread / 2));
+
+    /* Writers hammer one bucket; a lookup there must still finish, and see one of the values written. */
+    ConcurrentLinearHashTable<int, int> hot(1, 4);
+    hot.insert(1, 1);
+    std::atomic<bool> writing(true);
+    threads.clear();
+    for(int t = 0; t < 2; ++t){
+        threads.push_back(std::thread([&hot, &writing, t](){
+            for(int i = 0; writing.load(); ++i){
+                hot.insert(1, i % 2 + 1);
+                hot.insert(2 + t, i);
+                hot.remove(2 + t);
+            }
+        }));
+    }
+    for(int i = 0; i < 100000; ++i){
+        int val = 0;
+        assert(hot.find(1, val) == true);
+        assert(val == 1 || val == 2);
+    }
+    writing.store(false);
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    std::cout << "Concurrency tests passed!" << "\n";
+
+    /* A file-backed table, many times larger than its buffer pool, must come back intact after a clean close. */
+    std::string table_path = "test_linear_hash.persistent";
+    std::remove((table_path + ".buckets").c_str());
+    std::remove((table_path + ".overflow").c_str());
+    {
+        PersistentLinearHashTable<int, long long> plht(table_path, 3, 8, 16);
+        for(int i = 0; i < 30000; ++i){
+            plht.insert(i * 3, (long long) i * i);
+        }
+        for(int i = 0; i < 30000; i += 5){
+            assert(plht.remove(i * 3) == true);
+        }
+        assert(plht.remove(1) == false);
+        assert(plht.get_load_factor() <= 0.8);
+    }
+    {
+        PersistentLinearHashTable<int, long long> plht(table_path, 1, 1, 4);
+        assert(plht.size() == 24000);
+        assert(plht.get_num_buckets() > 3000);
+
+        /* Lookups read about one page each, whatever the size of the buffer pool. */
+        size_t reads = plht.get_page_reads();
+        for(int i = 0; i < 30000; ++i){
+            long long val = 0;
+            assert(plht.find(i * 3, val) == (i % 5 != 0));
+            assert(i % 5 == 0 || val == (long long) i * i);
+        }
+        assert(plht.get_page_reads() - reads < 30000 * 1.5);
+
+        /* Emptying overflow pages returns them for reuse. */
+        for(int i = 0; i < 30000; ++i){
+            if(i % 5 != 0){
+                plht.remove(i * 3);
+            }
+        }
+        assert(plht.size() == 0 && plht.get_num_overflow_pages() == 0);
+        for(int i = 0; i < 1000; ++i){
+            plht.insert(i, -i);
+        }
+    }
+
+    /*
+        A process crashing after changing a table must leave it recoverable: keys untouched since the last sync
+        are found, the recounted size matches the keys found, and every overflow page is freed once the table
+        is emptied. Pages of two slots chain often, and a tiny buffer pool writes pages back at every step,
+        so crashes hit half-written splits and removes.
+    */
+    std::string crash_path = "test_linear_hash.crashed";
+    std::remove((crash_path + ".buckets").c_str());
+    std::remove((crash_path + ".overflow").c_str());
+    {
+        PersistentLinearHashTable<int, long long> plht(crash_path, 1, 2, 4);
+        for(int i = 0; i < 1000; ++i){
+            plht.insert(i, -i);
+        }
+    }
+    for(int round = 0; round < 40; ++round){
+        pid_t child = fork();
+        if(child == 0){
+            PersistentLinearHashTable<int, long long> plht(crash_path, 1, 1, 4);
+            srand(round);
+            int num_ops = rand() % 4000;
+            for(int op = 0; op < num_ops; ++op){
+                int key = rand() % 4000;
+                if(rand() % 2){
+                    plht.insert(key, -key);
+                } else {
+                    plht.remove(key);
+                }
+            }
+            _exit(0);
+        }
+        waitpid(child, NULL, 0);
+
+        /* Replay the child's choices to learn which keys it touched. */
+        std::vector<bool> touched(4000, false);
+        srand(round);
+        int num_ops = rand() % 4000;
+        for(int op = 0; op < num_ops; ++op){
+            touched[rand() % 4000] = true;
+            rand();
+        }
+
+        PersistentLinearHashTable<int, long long> plht(crash_path, 1, 1, 4);
+        size_t found = 0;
+        for(int i = 0; i < 4000; ++i){
+            long long val = 0;
+            bool present = plht.find(i, val);
+            assert(touched[i] || present == (i < 1000));
+            assert(!present || val == -i);
+            found += present;
+        }
+        assert(plht.size() == found);
+
+        for(int i = 0; i < 4000; ++i){
+            plht.insert(i, -i);
+        }
+        for(int i = 0; i < 4000; ++i){
+            assert(plht.remove(i) == true);
+        }
+        assert(plht.size() == 0 && plht.get_num_overflow_pages() == 0);
+        for(int i = 0; i < 1000; ++i){
+            plht.insert(i, -i);
+        }
+    }
+    std::remove((crash_path + ".buckets").c_str());
+    std::remove((crash_path + ".overflow").c_str());
+
+    /* Opening a table as other types fails, without leaking the files it opened. */
+    int first_free_fd = dup(0);
+    close(first_free_fd);
+    bool refused = false;
+    try {
+        PersistentLinearHashTable<int, int> plht(table_path);
+    } catch(const std::runtime_error&){
+        refused = true;
+    }
+    assert(refused);
+    int next_free_fd = dup(0);
+    close(next_free_fd);
+    assert(next_free_fd == first_free_fd);
+    std::remove((table_path + ".buckets").c_str());
+    std::remove((table_path + ".overflow").c_str());
+
+    std::cout << "Persistence tests passed!" << "\n";
+
     std::cout << "All tests passed!" << "\n";
 
 }
@@ -0,0 +1,293 @@
+/*
+Skiplists in C++: Benchmarks
+Author: Ameya Daigavane
+Benchmarks for 'skiplist.hpp', 'concurrent_skiplist.hpp' and 'unrolled_skiplist.hpp'.
+*/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include "skiplist.hpp"
+#include "concurrent_skiplist.hpp"
+#include "unrolled_skiplist.hpp"
+
+// Small xorshift generator, one per thread.
+struct XorShift {
+    uint64_t state;
+
+    XorShift(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    uint64_t next(){
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+};
+
+// Run ops_per_thread operations on each of num_threads threads, and return the total throughput in Mops/s.
+// Each operation returns a number, which is summed so that the compiler cannot drop searches whose results are unused.
+template <typename OP>
+double run_threads(int num_threads, int ops_per_thread, OP op){
+    std::vector<std::thread> threads;
+    std::atomic<size_t> checksum(0);
+    auto start = std::chrono::steady_clock::now();
+
+    for(int t = 0; t < num_threads; ++t){
+        threads.push_back(std::thread([&op, &checksum, t, ops_per_thread](){
+            XorShift rng(t + 1);
+            size_t sum = 0;
+            for(int i = 0; i < ops_per_thread; ++i){
+                sum += op(rng);
+            }
+            checksum.fetch_add(sum);
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t){
+        threads[t].join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return num_threads * (double) ops_per_thread / elapsed.count() / 1e6;
+}
+
+// Mixed workload: 80% searches, 10% inserts and 10% removes over a key range preloaded to half, from 1 to 64 threads.
+void bench_concurrency(){
+    const int key_range = 1 << 18;
+    const int ops_per_thread = 100000;
+
+    std::cout << "Threads | global mutex (Mops/s) | lock-free (Mops/s)" << "\n";
+    for(int num_threads = 1; num_threads <= 64; num_threads *= 2){
+
+        Skiplist<int, int> sl;
+        ConcurrentSkiplist<int> csl;
+        for(int key = 0; key < key_range; key += 2){
+            sl.insert(key, key);
+            csl.insert(key);
+        }
+
+        std::mutex global_mutex;
+        double locked = run_threads(num_threads, ops_per_thread, [&](XorShift& rng){
+            uint64_t r = rng.next();
+            int key = (int) (r % key_range);
+            int op = (int) ((r >> 32) % 10);
+            std::lock_guard<std::mutex> guard(global_mutex);
+            bool present = sl.search(key);
+            if(op == 0){
+                sl.insert(key, key);
+            }
+            if(op == 1 and present){
+                sl.remove(key);
+            }
+            return (size_t) present;
+        });
+
+        double lock_free = run_threads(num_threads, ops_per_thread, [&](XorShift& rng){
+            uint64_t r = rng.next();
+            int key = (int) (r % key_range);
+            int op = (int) ((r >> 32) % 10);
+            if(op == 0){
+                return (size_t) csl.insert(key);
+            }
+            if(op == 1){
+                return (size_t) csl.remove(key);
+            }
+            return (size_t) csl.search(key);
+        });
+
+        std::cout << num_threads << " | " << locked << " | " << lock_free << "\n";
+    }
+}
+
+// Scan a window of a million consecutive keys out of a larger skiplist, with range() and with iterators.
+void bench_range(){
+    const int num_keys = 4000000;
+    const int window = 1000000;
+
+    Skiplist<long long, long long> sl;
+    XorShift rng(1);
+    for(int i = 0; i < num_keys; ++i){
+        long long key = (long long) (rng.next() % (1ull << 40));
+        sl.insert(key, i);
+    }
+
+    // A window starting at a random key, so that its nodes are spread over the arena.
+    long long lo = sl.lower_bound((long long) (rng.next() % (1ull << 39))).key();
+    Skiplist<long long, long long>::iterator it = sl.lower_bound(lo);
+    for(int i = 0; i < window; ++i){
+        ++it;
+    }
+    long long hi = it.key();
+
+    auto start = std::chrono::steady_clock::now();
+    long long sum = 0;
+    size_t visited = sl.range(lo, hi, [&sum](long long, long long val){
+        sum += val;
+    });
+    std::chrono::duration<double> range_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    long long iterated = 0;
+    for(Skiplist<long long, long long>::iterator curr = sl.lower_bound(lo); curr != sl.end() and curr.key() < hi; ++curr){
+        iterated += curr.value();
+    }
+    std::chrono::duration<double> iterator_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Range scan of " << visited << " keys: range() " << range_time.count() * 1e3 << " ms, iterators "
+              << iterator_time.count() * 1e3 << " ms" << (sum == iterated ? "" : " (mismatch!)") << "\n";
+}
+
+// Load sorted records with one insert per record, with from_sorted(), and by merging two halves,
+// against copying the same records in memory.
+void bench_bulk(){
+    const int num_keys = 5000000;
+
+    std::vector<std::pair<long long, long long>> records(num_keys);
+    for(int i = 0; i < num_keys; ++i){
+        records[i] = std::make_pair((long long) i * 3, (long long) i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<long long, long long>> copied(num_keys);
+    std::copy(records.begin(), records.end(), copied.begin());
+    std::chrono::duration<double> copy_time = std::chrono::steady_clock::now() - start;
+
+    Skiplist<long long, long long> inserted;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < num_keys; ++i){
+        inserted.insert(records[i].first, records[i].second);
+    }
+    std::chrono::duration<double> insert_time = std::chrono::steady_clock::now() - start;
+
+    Skiplist<long long, long long> built;
+    start = std::chrono::steady_clock::now();
+    built.from_sorted(records.begin(), records.end());
+    std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start;
+
+    Skiplist<long long, long long> sampled;
+    start = std::chrono::steady_clock::now();
+    sampled.from_sorted(records.begin(), records.end(), true);
+    std::chrono::duration<double> sampled_time = std::chrono::steady_clock::now() - start;
+
+    // Interleaved halves, so that the merge alternates between both lists.
+    Skiplist<long long, long long> evens, odds;
+    std::vector<std::pair<long long, long long>> even_records, odd_records;
+    for(int i = 0; i < num_keys; ++i){
+        (i % 2 ? odd_records : even_records).push_back(records[i]);
+    }
+    evens.from_sorted(even_records.begin(), even_records.end());
+    odds.from_sorted(odd_records.begin(), odd_records.end());
+    start = std::chrono::steady_clock::now();
+    evens.merge(odds);
+    std::chrono::duration<double> merge_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Loading " << num_keys << " sorted records: copy " << copy_time.count() * 1e3 << " ms, insert() "
+              << insert_time.count() * 1e3 << " ms, from_sorted() " << build_time.count() * 1e3 << " ms, sampled heights "
+              << sampled_time.count() * 1e3 << " ms, merging two halves " << merge_time.count() * 1e3 << " ms"
+              << (built.size() == inserted.size() and evens.size() == inserted.size() ? "" : " (mismatch!)") << "\n";
+}
+
+// Time inserting keys into a map, looking up a million of them in random order, and scanning a window
+// of a million consecutive keys with range().
+template <typename MAP>
+void time_map(const char * name, const std::vector<long long>& keys, long long lo, long long hi){
+    const int num_lookups = 1000000;
+
+    MAP map;
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i){
+        map.insert(keys[i], (long long) i);
+    }
+    std::chrono::duration<double> insert_time = std::chrono::steady_clock::now() - start;
+
+    XorShift rng(2);
+    start = std::chrono::steady_clock::now();
+    long long found = 0;
+    for(int i = 0; i < num_lookups; ++i){
+        typename MAP::iterator it = map.find(keys[rng.next() % keys.size()]);
+        found += it.value();
+    }
+    std::chrono::duration<double> lookup_time = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    long long sum = 0;
+    size_t visited = map.range(lo, hi, [&sum](long long, long long val){
+        sum += val;
+    });
+    std::chrono::duration<double> range_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << ": " << keys.size() << " inserts " << insert_time.count() * 1e3 << " ms, " << num_lookups
+              << " lookups " << lookup_time.count() * 1e3 << " ms, range scan of " << visited << " keys "
+              << range_time.count() * 1e3 << " ms (checksum " << (found + sum) % 1000 << ")\n";
+}
+
+// Lookups and range scans on a large Skiplist against an UnrolledSkiplist holding the same random keys.
+void bench_unrolled(){
+    const int num_keys = 4000000;
+    const int window = 1000000;
+
+    std::vector<long long> keys(num_keys);
+    XorShift rng(1);
+    for(int i = 0; i < num_keys; ++i){
+        keys[i] = (long long) (rng.next() % (1ull << 40));
+    }
+
+    std::vector<long long> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    long long lo = sorted[num_keys / 4];
+    long long hi = sorted[num_keys / 4 + window];
+
+    time_map<Skiplist<long long, long long>>("Skiplist", keys, lo, hi);
+    time_map<UnrolledSkiplist<long long, long long>>("UnrolledSkiplist", keys, lo, hi);
+}
+
+// Memory and latency of Skiplists holding the same random keys, for several promotion probabilities.
+void bench_promotion(){
+    const int num_keys = 2000000;
+    const int num_lookups = 1000000;
+    const double promotions[] = {0.5, 0.25, 0.36787944117144233, 0.125};
+    const char * names[] = {"1/2", "1/4", "1/e", "1/8"};
+
+    std::vector<long long> keys(num_keys);
+    XorShift rng(3);
+    for(int i = 0; i < num_keys; ++i){
+        keys[i] = (long long) (rng.next() % (1ull << 40));
+    }
+
+    std::cout << "p | bytes per entry | insert (ns) | lookup (ns)" << "\n";
+    for(int p = 0; p < 4; ++p){
+        Skiplist<long long, long long> sl(promotions[p]);
+
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_keys; ++i){
+            sl.insert(keys[i], i);
+        }
+        std::chrono::duration<double> insert_time = std::chrono::steady_clock::now() - start;
+
+        XorShift lookups(4);
+        long long found = 0;
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < num_lookups; ++i){
+            found += sl.find(keys[lookups.next() % num_keys]).value();
+        }
+        std::chrono::duration<double> lookup_time = std::chrono::steady_clock::now() - start;
+
+        std::cout << names[p] << " | " << (double) sl.get_memory_usage() / sl.size() << " | "
+                  << insert_time.count() * 1e9 / num_keys << " | " << lookup_time.count() * 1e9 / num_lookups
+                  << (found > 0 ? "" : " (nothing found!)") << "\n";
+    }
+}
+
+int main(){
+    bench_concurrency();
+    bench_range();
+    bench_bulk();
+    bench_unrolled();
+    bench_promotion();
+}
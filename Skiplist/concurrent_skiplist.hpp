@@ -0,0 +1,488 @@
+/*
+Concurrent Skiplists in C++
+Author: Ameya Daigavane
+A lock-free variant of Skiplist, after Fraser, and Herlihy and Shavit. Every level of a node's tower is linked
+with compare-and-swap, and removal first marks the tower's next pointers, top level first, so that no thread
+links anything after a node being removed. The thread marking level 0 owns the removal. Marked nodes are
+unlinked by whichever thread's search walks past them, and freed through epoch-based reclamation, once no
+thread can still hold a pointer to them.
+*/
+
+#ifndef CONCURRENT_SKIPLIST_HPP
+#define CONCURRENT_SKIPLIST_HPP
+
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// The max-height of the concurrent skiplist.
+// Note: the skiplist's bottomost list is at height 0
+const size_t concurrent_skiplist_max_height = 32;
+
+// Epoch-based reclamation, shared by all concurrent skiplists of a program.
+// Threads announce the global epoch while they traverse a skiplist. The global epoch only advances once every
+// thread inside a traversal has announced it, so memory retired at epoch e is freed once the epoch reaches e + 2.
+class skiplist_epochs {
+
+  private:
+    struct retired_node {
+        void * node;
+        void (* deleter)(void *);
+        uint64_t epoch;
+    };
+
+    // One per thread, reused after the thread exits along with the memory it left to free.
+    struct thread_record {
+
+        // (epoch << 1) | 1 while inside a traversal, 0 otherwise.
+        std::atomic<uint64_t> announced;
+        std::atomic<bool> in_use;
+        size_t depth;
+        std::vector<retired_node> retired;
+        thread_record * next_record;
+    };
+
+    // Releases the calling thread's record when the thread exits.
+    struct thread_handle {
+        thread_record * record;
+
+        thread_handle() : record(NULL) {}
+
+        ~thread_handle() {
+            if(record != NULL){
+                record -> in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<uint64_t> global_epoch;
+    std::atomic<thread_record *> records;
+
+    // Retired nodes per thread between attempts to advance the epoch.
+    static const size_t scan_interval = 64;
+
+    skiplist_epochs() : global_epoch(0), records(NULL) {}
+
+    thread_record * acquire_record() {
+        for(thread_record * rec = records.load(std::memory_order_acquire); rec != NULL; rec = rec -> next_record){
+            bool expected = false;
+            if(!rec -> in_use.load(std::memory_order_relaxed) and rec -> in_use.compare_exchange_strong(expected, true, std::memory_order_acq_rel)){
+                return rec;
+            }
+        }
+
+        thread_record * rec = new thread_record();
+        rec -> announced.store(0, std::memory_order_relaxed);
+        rec -> in_use.store(true, std::memory_order_relaxed);
+        rec -> depth = 0;
+        rec -> next_record = records.load(std::memory_order_relaxed);
+        while(!records.compare_exchange_weak(rec -> next_record, rec, std::memory_order_acq_rel)){}
+        return rec;
+    }
+
+    thread_record * record() {
+        static thread_local thread_handle handle;
+        if(handle.record == NULL){
+            handle.record = acquire_record();
+        }
+        return handle.record;
+    }
+
+    // Advance the global epoch if every thread inside a traversal has announced the current one.
+    void try_advance() {
+        uint64_t epoch = global_epoch.load(std::memory_order_seq_cst);
+        for(thread_record * rec = records.load(std::memory_order_acquire); rec != NULL; rec = rec -> next_record){
+            uint64_t announced = rec -> announced.load(std::memory_order_seq_cst);
+            if((announced & 1) and (announced >> 1) != epoch){
+                return;
+            }
+        }
+        global_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    }
+
+    // Free this thread's retired nodes which no thread can reach anymore. They are retired in epoch order.
+    void collect(thread_record * rec) {
+        uint64_t epoch = global_epoch.load(std::memory_order_seq_cst);
+        size_t freed = 0;
+        while(freed < rec -> retired.size() and rec -> retired[freed].epoch + 2 <= epoch){
+            rec -> retired[freed].deleter(rec -> retired[freed].node);
+            freed += 1;
+        }
+        rec -> retired.erase(rec -> retired.begin(), rec -> retired.begin() + freed);
+    }
+
+  public:
+    static skiplist_epochs& instance() {
+        static skiplist_epochs domain;
+        return domain;
+    }
+
+    // Frees everything still retired, once no thread uses any skiplist anymore.
+    ~skiplist_epochs() {
+        thread_record * rec = records.load(std::memory_order_acquire);
+        while(rec != NULL){
+            for(size_t i = 0; i < rec -> retired.size(); ++i){
+                rec -> retired[i].deleter(rec -> retired[i].node);
+            }
+            thread_record * next = rec -> next_record;
+            delete rec;
+            rec = next;
+        }
+    }
+
+    skiplist_epochs(const skiplist_epochs&) = delete;
+    skiplist_epochs& operator=(const skiplist_epochs&) = delete;
+
+    // Bracket every traversal with these. Nested traversals keep the outermost epoch.
+    void enter() {
+        thread_record * rec = record();
+        if(rec -> depth++ == 0){
+            rec -> announced.store((global_epoch.load(std::memory_order_seq_cst) << 1) | 1, std::memory_order_seq_cst);
+        }
+    }
+
+    void exit() {
+        thread_record * rec = record();
+        if(--rec -> depth == 0){
+            rec -> announced.store(0, std::memory_order_release);
+        }
+    }
+
+    // Free node with deleter once no thread can reach it. node must already be unlinked.
+    void retire(void * node, void (* deleter)(void *)) {
+        thread_record * rec = record();
+        retired_node entry = {node, deleter, global_epoch.load(std::memory_order_seq_cst)};
+        rec -> retired.push_back(entry);
+
+        if(rec -> retired.size() % scan_interval == 0){
+            try_advance();
+            collect(rec);
+        }
+    }
+};
+
+// Stays inside an epoch for its lifetime.
+struct skiplist_epoch_guard {
+    skiplist_epoch_guard() {
+        skiplist_epochs::instance().enter();
+    }
+
+    ~skiplist_epoch_guard() {
+        skiplist_epochs::instance().exit();
+    }
+
+    skiplist_epoch_guard(const skiplist_epoch_guard&) = delete;
+    skiplist_epoch_guard& operator=(const skiplist_epoch_guard&) = delete;
+};
+
+// Like skiplist_node, the tower is laid out inline after the node. Its next pointers carry a mark
+// in their lowest bit once the node is being removed.
+template <typename TYPE>
+struct concurrent_skiplist_node {
+
+    TYPE val;
+    size_t height;
+
+    // Removal is finished by whichever of the inserting thread and the removing thread is done last.
+    std::atomic<int> owners;
+    std::atomic<uintptr_t> next[1];
+
+    concurrent_skiplist_node(const TYPE& inp_val, size_t inp_height) : val(inp_val), owners(2) {
+        height = inp_height;
+    }
+
+    static concurrent_skiplist_node * create(const TYPE& val, size_t height) {
+        void * memory = ::operator new(sizeof(concurrent_skiplist_node) + height * sizeof(std::atomic<uintptr_t>));
+        concurrent_skiplist_node * node = new (memory) concurrent_skiplist_node(val, height);
+        for(size_t i = 1; i <= height; ++i){
+            new (&node -> next[i]) std::atomic<uintptr_t>(0);
+        }
+        return node;
+    }
+
+    static void destroy(void * memory) {
+        concurrent_skiplist_node * node = static_cast<concurrent_skiplist_node *>(memory);
+        node -> ~concurrent_skiplist_node();
+        ::operator delete(memory);
+    }
+
+    static bool is_marked(uintptr_t link) {
+        return link & 1;
+    }
+
+    static concurrent_skiplist_node * pointer(uintptr_t link) {
+        return reinterpret_cast<concurrent_skiplist_node *>(link & ~(uintptr_t) 1);
+    }
+
+    static uintptr_t link(concurrent_skiplist_node * node) {
+        return reinterpret_cast<uintptr_t>(node);
+    }
+};
+
+// A set: unlike Skiplist, each value is stored at most once. All methods may be called concurrently.
+template <typename TYPE>
+class ConcurrentSkiplist {
+
+  private:
+    typedef concurrent_skiplist_node<TYPE> node_type;
+
+    // Sentinel start node, with a full tower. The lists end with NULL.
+    node_type * start;
+
+    // Highest level holding any node, where searches start. Never lowered.
+    std::atomic<size_t> max_level;
+
+    std::atomic<size_t> skiplist_size;
+
+    // Per-thread xorshift generator, so that level generation needs no shared state.
+    static size_t random_level() {
+        static thread_local uint64_t state = 0;
+        if(state == 0){
+            state = std::hash<std::thread::id>()(std::this_thread::get_id()) * 0x9E3779B97F4A7C15ull | 1;
+        }
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        // Each level is kept with probability 1/2: count the trailing ones.
+        size_t level = 0;
+        uint64_t bits = state;
+        while((bits & 1) and level < concurrent_skiplist_max_height){
+            level += 1;
+            bits >>= 1;
+        }
+        return level;
+    }
+
+    // find(val, prev, succ):
+    // fills prev[level] with the last node whose value is less than val at every level, and succ[level] with
+    // the node after it, unlinking marked nodes on the way. Returns true if succ[0] holds val.
+    // Must be called inside an epoch.
+    bool find(const TYPE& val, node_type ** prev, node_type ** succ) {
+
+      retry:
+        node_type * pred = start;
+        size_t top = max_level.load(std::memory_order_acquire);
+        for(size_t level = concurrent_skiplist_max_height; level > top; --level){
+            prev[level] = start;
+            succ[level] = node_type::pointer(start -> next[level].load(std::memory_order_acquire));
+        }
+
+        size_t level = top;
+        while(true){
+            node_type * curr = node_type::pointer(pred -> next[level].load(std::memory_order_acquire));
+            while(curr != NULL){
+                uintptr_t next = curr -> next[level].load(std::memory_order_acquire);
+
+                // curr is being removed: unlink it at this level, or start over if pred changed meanwhile.
+                while(node_type::is_marked(next)){
+                    uintptr_t expected = node_type::link(curr);
+                    if(!pred -> next[level].compare_exchange_strong(expected, next & ~(uintptr_t) 1, std::memory_order_acq_rel)){
+                        goto retry;
+                    }
+                    curr = node_type::pointer(next);
+                    if(curr == NULL){
+                        break;
+                    }
+                    next = curr -> next[level].load(std::memory_order_acquire);
+                }
+
+                if(curr != NULL and curr -> val < val){
+                    pred = curr;
+                    curr = node_type::pointer(next);
+                } else {
+                    break;
+                }
+            }
+            prev[level] = pred;
+            succ[level] = curr;
+
+            if(level == 0){
+                break;
+            }
+            level -= 1;
+        }
+
+        return succ[0] != NULL and !(val < succ[0] -> val);
+    }
+
+    // The inserting and the removing thread each release the node once done with it; the last one frees it.
+    void release(node_type * node) {
+        if(node -> owners.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            skiplist_epochs::instance().retire(node, node_type::destroy);
+        }
+    }
+
+  public:
+    ConcurrentSkiplist() : max_level(0), skiplist_size(0) {
+        start = node_type::create(TYPE(), concurrent_skiplist_max_height);
+        for(size_t i = 0; i <= concurrent_skiplist_max_height; ++i){
+            start -> next[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // No other thread may use the skiplist anymore. Values removed earlier are freed by the epochs.
+    ~ConcurrentSkiplist() {
+        node_type * curr = start;
+        while(curr != NULL){
+            node_type * next = node_type::pointer(curr -> next[0].load(std::memory_order_relaxed));
+            node_type::destroy(curr);
+            curr = next;
+        }
+    }
+
+    ConcurrentSkiplist(const ConcurrentSkiplist&) = delete;
+    ConcurrentSkiplist& operator=(const ConcurrentSkiplist&) = delete;
+
+    // Search for a value. Never writes to the skiplist.
+    bool search(const TYPE& val) {
+        skiplist_epoch_guard guard;
+
+        node_type * pred = start;
+        node_type * curr = NULL;
+        size_t level = max_level.load(std::memory_order_acquire);
+        while(true){
+            curr = node_type::pointer(pred -> next[level].load(std::memory_order_acquire));
+            while(curr != NULL){
+
+                // Step over marked nodes without unlinking them.
+                uintptr_t next = curr -> next[level].load(std::memory_order_acquire);
+                while(node_type::is_marked(next)){
+                    curr = node_type::pointer(next);
+                    if(curr == NULL){
+                        break;
+                    }
+                    next = curr -> next[level].load(std::memory_order_acquire);
+                }
+
+                if(curr != NULL and curr -> val < val){
+                    pred = curr;
+                    curr = node_type::pointer(next);
+                } else {
+                    break;
+                }
+            }
+
+            if(level == 0){
+                break;
+            }
+            level -= 1;
+        }
+
+        return curr != NULL and !(val < curr -> val);
+    }
+
+    // Insert a value. Returns false if it was already present.
+    bool insert(const TYPE& val) {
+        skiplist_epoch_guard guard;
+        node_type * prev[concurrent_skiplist_max_height + 1];
+        node_type * succ[concurrent_skiplist_max_height + 1];
+
+        size_t height = random_level();
+        node_type * new_node = node_type::create(val, height);
+
+        // Link level 0, which makes the value present.
+        while(true){
+            if(find(val, prev, succ)){
+                node_type::destroy(new_node);
+                return false;
+            }
+            for(size_t i = 0; i <= height; ++i){
+                new_node -> next[i].store(node_type::link(succ[i]), std::memory_order_relaxed);
+            }
+
+            uintptr_t expected = node_type::link(succ[0]);
+            if(prev[0] -> next[0].compare_exchange_strong(expected, node_type::link(new_node), std::memory_order_acq_rel)){
+                break;
+            }
+        }
+        skiplist_size.fetch_add(1, std::memory_order_relaxed);
+
+        size_t top = max_level.load(std::memory_order_relaxed);
+        while(top < height and !max_level.compare_exchange_weak(top, height, std::memory_order_acq_rel)){}
+
+        // Link the upper levels, stopping as soon as a removal marks the tower.
+        for(size_t i = 1; i <= height; ++i){
+            while(true){
+                uintptr_t next = new_node -> next[i].load(std::memory_order_acquire);
+                if(node_type::is_marked(next)){
+                    break;
+                }
+                if(next != node_type::link(succ[i]) and
+                   !new_node -> next[i].compare_exchange_strong(next, node_type::link(succ[i]), std::memory_order_acq_rel)){
+                    break;
+                }
+
+                uintptr_t expected = node_type::link(succ[i]);
+                if(prev[i] -> next[i].compare_exchange_strong(expected, node_type::link(new_node), std::memory_order_acq_rel)){
+                    break;
+                }
+
+                // Someone linked a node in between: search again, or stop if this value was removed meanwhile.
+                find(val, prev, succ);
+                if(succ[0] != new_node){
+                    break;
+                }
+            }
+            if(node_type::is_marked(new_node -> next[i].load(std::memory_order_acquire))){
+                break;
+            }
+        }
+
+        // A removal which raced with linking the tower may have missed the last levels linked.
+        if(node_type::is_marked(new_node -> next[0].load(std::memory_order_acquire))){
+            find(val, prev, succ);
+        }
+        release(new_node);
+        return true;
+    }
+
+    // Remove a value. Returns false if it was not present.
+    bool remove(const TYPE& val) {
+        skiplist_epoch_guard guard;
+        node_type * prev[concurrent_skiplist_max_height + 1];
+        node_type * succ[concurrent_skiplist_max_height + 1];
+
+        if(!find(val, prev, succ)){
+            return false;
+        }
+        node_type * node = succ[0];
+
+        // Mark the upper levels, top first.
+        for(size_t i = node -> height; i >= 1; --i){
+            uintptr_t next = node -> next[i].load(std::memory_order_acquire);
+            while(!node_type::is_marked(next)){
+                node -> next[i].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel);
+            }
+        }
+
+        // Marking level 0 decides which thread removes the value.
+        uintptr_t next = node -> next[0].load(std::memory_order_acquire);
+        while(true){
+            if(node_type::is_marked(next)){
+                return false;
+            }
+            if(node -> next[0].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel)){
+                break;
+            }
+        }
+        skiplist_size.fetch_sub(1, std::memory_order_relaxed);
+
+        // Unlink it from every level.
+        find(val, prev, succ);
+        release(node);
+        return true;
+    }
+
+    // Number of values, exact when no other thread is modifying the skiplist.
+    size_t size() {
+        return skiplist_size.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
@@ -3,218 +3,882 @@ Skiplists in C++
 Author: Ameya Daigavane
 Date: 15th May 2018
 A C++ implementation of skiplists, a randomized data structure supporting logarithmic expected-time insert, search and delete operations.
+Skiplist<KEY, VAL, Compare> maps keys, ordered by Compare, to values, and supports ordered iteration and range scans.
+Every link also counts the entries it skips over, so entries can be found and removed by rank in logarithmic time.
 */
 
+#ifndef SKIPLIST_HPP
+#define SKIPLIST_HPP
+
 #include <stdexcept>
-#include <limits>
 #include <cstdlib>
 #include <ctime>
-
-// The max-height of the skiplist.
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <functional>
+#include <ostream>
+#include <type_traits>
+
+// The max-height of any skiplist. Each skiplist caps its heights lower, according to its promotion probability.
 // Note: the skiplist's bottomost list is at height 0
 const size_t skiplist_max_height = 50;
 
-// Note: range of values the int skiplist supports is (-INT_MIN, INT_MAX)
+// Hint the processor to start loading the cache line at addr.
+inline void skiplist_prefetch(const void * addr){
+#if defined(__GNUC__)
+    __builtin_prefetch(addr);
+#endif
+}
+
+// Draws node heights for one skiplist: a node at level i also reaches level i + 1 with probability p.
+// Heights are capped at max_height, the level holding one node in 2^32 on average, so the sentinels
+// only need that many links.
+// Each height takes a single xorshift draw. When p is 2^-b, the height is the number of trailing zeros
+// of the draw, divided by b. Otherwise, the draw is compared against p^i * 2^64 for increasing i.
+class skiplist_level_generator {
+
+  private:
+    uint64_t state;
+    double promotion;
+    size_t shift;
+    size_t max_height;
+    uint64_t thresholds[skiplist_max_height + 1];
+
+    static size_t trailing_zeros(uint64_t bits){
+#if defined(__GNUC__)
+        return __builtin_ctzll(bits);
+#else
+        size_t zeros = 0;
+        while(!(bits & 1)){
+            bits >>= 1;
+            zeros += 1;
+        }
+        return zeros;
+#endif
+    }
+
+  public:
+    skiplist_level_generator(double p, uint64_t seed) {
+        if(!(p > 0 and p < 1)){
+            throw std::invalid_argument("Promotion probability must be between 0 and 1.");
+        }
+
+        promotion = p;
+        state = seed * 0x9E3779B97F4A7C15ull | 1;
+
+        double bits = -std::log2(p);
+        shift = 0;
+        if(bits == std::floor(bits)){
+            shift = (size_t) bits;
+        }
+
+        max_height = (size_t) std::ceil(32 / bits);
+        if(max_height > skiplist_max_height){
+            max_height = skiplist_max_height;
+        }
+
+        for(size_t i = 0; i <= max_height; ++i){
+            double threshold = std::ldexp(std::pow(p, (double) i), 64);
+            thresholds[i] = threshold >= 18446744073709551615.0 ? UINT64_MAX : (uint64_t) threshold;
+        }
+    }
+
+    double get_promotion() const {
+        return promotion;
+    }
+
+    size_t get_max_height() const {
+        return max_height;
+    }
+
+    // Height of a new node.
+    size_t next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        size_t level = 0;
+        if(shift != 0){
+            // The top bit stops the count, so that a draw of zero stays defined.
+            level = trailing_zeros(state | ((uint64_t) 1 << 63)) / shift;
+            return level < max_height ? level : max_height;
+        }
+
+        while(level < max_height and state < thresholds[level + 1]){
+            level += 1;
+        }
+        return level;
+    }
+
+    // Height of the entry at position (from 1) of a perfectly balanced skiplist: the number of times
+    // position divides by 1/p, rounded to an integer.
+    size_t balanced(size_t position) const {
+        size_t level = 0;
+        if(shift != 0){
+            level = trailing_zeros(position) / shift;
+        } else {
+            size_t base = (size_t) std::round(1 / promotion);
+            if(base < 2){
+                base = 2;
+            }
+            while(position % base == 0){
+                position /= base;
+                level += 1;
+            }
+        }
+        return level < max_height ? level : max_height;
+    }
+
+};
+
+// The tower of next pointers is laid out inline, right after the node, followed by the spans of the links:
+// nodes are allocated with room for height + 1 of each by skiplist_arena. The span of next[i] is the number
+// of level 0 steps it covers. Level 0 is also linked backwards, for bidirectional iteration.
 template <typename KEY, typename VAL>
 struct skiplist_node {
 
-    KEY key;
-    VAL val;
+    std::pair<const KEY, VAL> entry;
     size_t height;
-    skiplist_node ** next;
+    skiplist_node * prev;
+    skiplist_node * next[1];
 
-    skiplist_node(KEY inp_key, VAL inp_val, size_t inp_height){
-        key = inp_key;
-        val = inp_val;
+    skiplist_node(const KEY& inp_key, const VAL& inp_val, size_t inp_height) : entry(inp_key, inp_val) {
         height = inp_height;
-        next = new skiplist_node* [height + 1];
+        prev = NULL;
+    }
+
+    const KEY& key() const {
+        return entry.first;
+    }
+
+    size_t * span() {
+        return reinterpret_cast<size_t *>(next + height + 1);
+    }
+
+    // Bytes needed for a node with a tower of height + 1 pointers and spans.
+    static size_t bytes(size_t height){
+        size_t size = sizeof(skiplist_node) + height * sizeof(skiplist_node *) + (height + 1) * sizeof(size_t);
+        return (size + alignof(skiplist_node) - 1) / alignof(skiplist_node) * alignof(skiplist_node);
+    }
+
+};
+
+// Allocates the nodes of one skiplist out of large blocks, so that an insert makes no heap allocation
+// most of the time. Freed nodes are kept on one free list per height, linked through next[0],
+// and reused by later nodes of the same height.
+template <typename NODE>
+class skiplist_arena {
+
+  private:
+    static const size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char * cursor;
+    size_t remaining;
+    size_t allocated;
+    NODE * free_lists[skiplist_max_height + 1];
+
+  public:
+    skiplist_arena() {
+        cursor = NULL;
+        remaining = 0;
+        allocated = 0;
+        for(size_t i = 0; i <= skiplist_max_height; ++i){
+            free_lists[i] = NULL;
+        }
+    }
+
+    skiplist_arena(const skiplist_arena&) = delete;
+    skiplist_arena& operator=(const skiplist_arena&) = delete;
+
+    // Uninitialized memory for a node of the given height.
+    void * allocate(size_t height) {
+
+        if(free_lists[height] != NULL){
+            NODE * node = free_lists[height];
+            free_lists[height] = node -> next[0];
+            return node;
+        }
+
+        size_t size = NODE::bytes(height);
+        if(size > remaining){
+            size_t new_block = size > block_size ? size : block_size;
+            blocks.push_back(std::unique_ptr<char[]>(new char[new_block]));
+            cursor = blocks.back().get();
+            remaining = new_block;
+        }
+
+        void * memory = cursor;
+        cursor += size;
+        remaining -= size;
+        allocated += size;
+        return memory;
+    }
+
+    // Give back the memory of a node, already destroyed.
+    void release(NODE * node, size_t height) {
+        node -> next[0] = free_lists[height];
+        free_lists[height] = node;
+    }
+
+    // Take over all blocks of other, along with its free nodes. other is left empty.
+    void absorb(skiplist_arena& other) {
+        for(size_t i = 0; i < other.blocks.size(); ++i){
+            blocks.push_back(std::move(other.blocks[i]));
+        }
+        allocated += other.allocated;
+        for(size_t i = 0; i <= skiplist_max_height; ++i){
+            while(other.free_lists[i] != NULL){
+                NODE * node = other.free_lists[i];
+                other.free_lists[i] = node -> next[0];
+                release(node, i);
+            }
+        }
+        other.clear();
+    }
+
+    // Bytes of all nodes carved out of the blocks so far, including freed nodes waiting for reuse.
+    size_t get_allocated_bytes() const {
+        return allocated;
+    }
+
+    // Free every block at once.
+    void clear() {
+        blocks.clear();
+        cursor = NULL;
+        remaining = 0;
+        allocated = 0;
+        for(size_t i = 0; i <= skiplist_max_height; ++i){
+            free_lists[i] = NULL;
+        }
     }
 
 };
 
-template <typename TYPE>
+template <typename KEY, typename VAL, typename Compare>
 class Skiplist;
 
-template <typename TYPE>
-std::ostream& operator<< (std::ostream& os, const Skiplist<TYPE>& sl);
+template <typename KEY, typename VAL, typename Compare>
+std::ostream& operator<< (std::ostream& os, const Skiplist<KEY, VAL, Compare>& sl);
 
-template <typename TYPE>
+template <typename KEY, typename VAL, typename Compare = std::less<KEY>>
 class Skiplist {
 
   private:
-    // Sentinel nodes - start and end.
-    skiplist_node<TYPE> * start;
-    skiplist_node<TYPE> * end;
+    typedef skiplist_node<KEY, VAL> node_type;
+
+    // Sentinel nodes - start and end. Their keys are never compared.
+    node_type * start;
+    node_type * end_node;
 
     // Number of nodes/items currently stored
     size_t skiplist_size;
 
-    // search_helper(val, min_level):
-    // if val is found in the levels >= minlevel, returns a pointer to the node with value val,
-    // else, returns a pointer to the node just before where it should be.
+    // Highest level holding any node, where searches start. 0 when empty.
+    size_t max_level;
+
+    Compare comp;
+
+    // Heights of new nodes. Also caps the height of the sentinels.
+    skiplist_level_generator levels;
+
+    // Memory for all nodes, sentinels included.
+    skiplist_arena<node_type> arena;
+
+    node_type * create_node(const KEY& key, const VAL& val, size_t height) {
+        return new (arena.allocate(height)) node_type(key, val, height);
+    }
+
+    void destroy_node(node_type * node) {
+        size_t height = node -> height;
+        node -> ~node_type();
+        arena.release(node, height);
+    }
+
+    // Destroy the entries of all nodes, sentinels included. Nothing to do for trivially destructible types.
+    void destroy_all() {
+        if(std::is_trivially_destructible<KEY>::value and std::is_trivially_destructible<VAL>::value){
+            return;
+        }
+
+        node_type * curr = start;
+        while(curr != NULL){
+            node_type * next = curr -> next[0];
+            curr -> ~node_type();
+            curr = next;
+        }
+    }
+
+    // Create empty sentinels.
+    void init() {
+        start = create_node(KEY(), VAL(), levels.get_max_height());
+        end_node = create_node(KEY(), VAL(), levels.get_max_height());
+
+        for(size_t i = 0; i <= start -> height; ++i)
+        {
+            start -> next[i] = end_node;
+            start -> span()[i] = 1;
+        }
+
+        for(size_t i = 0; i <= end_node -> height; ++i)
+        {
+            end_node -> next[i] = NULL;
+        }
+        end_node -> prev = start;
+
+        // Initialize size.
+        skiplist_size = 0;
+        max_level = 0;
+    }
+
+    // find_predecessors(key, prev, pos):
+    // fills prev[level], for every level, with the last node at that level whose key is less than key,
+    // in a single descent starting from the highest occupied level, and pos[level] with its position
+    // (start is at position 0, the first entry at 1). The node following prev[0] is then the first
+    // node whose key is at least key.
     //
     // Idea:
-    // If current key == val, done.
-    // Go right if next key <= val
-    // Go down if next key > val
-    skiplist_node<TYPE> * search_helper(TYPE val, size_t min_level) {
+    // Go right while next key < key
+    // Go down otherwise
+    void find_predecessors(const KEY& key, node_type ** prev, size_t * pos) {
 
-        skiplist_node<TYPE> * curr;
-        skiplist_node<TYPE> * next;
-        size_t curr_height = skiplist_max_height;
+        node_type * curr = start;
+        size_t curr_pos = 0;
 
-        curr = start;
-        next = curr -> next[curr_height];
+        for(size_t level = start -> height; level > max_level; --level){
+            prev[level] = start;
+            pos[level] = 0;
+        }
 
-        while(curr -> val != val){
-            // next value is also lesser, we can go right
-            if(next -> val <= val){
+        size_t level = max_level;
+        while(true){
+            node_type * next = curr -> next[level];
+            while(next != end_node and comp(next -> key(), key)){
+                curr_pos += curr -> span()[level];
                 curr = next;
-                next = curr -> next[curr_height];
+                next = curr -> next[level];
             }
-            // next value is smaller, go to lower list
-            else{
-                if(curr_height > min_level){
-                    curr_height -= 1;
-                    next = curr -> next[curr_height];
-                }
-                else {
-                    break;
-                }
+            prev[level] = curr;
+            pos[level] = curr_pos;
+
+            if(level == 0){
+                break;
             }
+            level -= 1;
         }
+    }
+
+    // Like find_predecessors, for the last node at every level whose position is at most position.
+    void find_position(size_t position, node_type ** prev, size_t * pos) {
+
+        node_type * curr = start;
+        size_t curr_pos = 0;
+
+        size_t level = max_level;
+        while(true){
+            while(curr -> next[level] != end_node and curr_pos + curr -> span()[level] <= position){
+                curr_pos += curr -> span()[level];
+                curr = curr -> next[level];
+            }
+            prev[level] = curr;
+            pos[level] = curr_pos;
 
-        return curr;
+            if(level == 0){
+                break;
+            }
+            level -= 1;
+        }
     }
 
-    // Insert val from levels 0 upto level.
-    void insert_upto_level(TYPE val, size_t level) {
+    // The first node whose key is not less than key (strict = false), or greater than key (strict = true),
+    // found in one descent without recording predecessors.
+    node_type * lower_node(const KEY& key, bool strict) const {
 
-        skiplist_node<TYPE> * curr;
-        skiplist_node<TYPE> * new_node = new skiplist_node<TYPE>(val, level);
+        node_type * curr = start;
+        size_t level = max_level;
+        while(true){
+            node_type * next = curr -> next[level];
+            while(next != end_node and (strict ? !comp(key, next -> key()) : comp(next -> key(), key))){
+                curr = next;
+                next = curr -> next[level];
+            }
 
+            if(level == 0){
+                return next;
+            }
+            level -= 1;
+        }
+    }
+
+    bool equal(const KEY& a, const KEY& b) const {
+        return !comp(a, b) and !comp(b, a);
+    }
+
+    // Insert key from levels 0 upto level, linking it after the predecessors found in one descent.
+    // If key is present already, its value is overwritten instead.
+    void insert_upto_level(const KEY& key, const VAL& val, size_t level) {
+
+        node_type * prev[skiplist_max_height + 1];
+        size_t pos[skiplist_max_height + 1];
+        find_predecessors(key, prev, pos);
+
+        node_type * next = prev[0] -> next[0];
+        if(next != end_node and equal(next -> key(), key)){
+            next -> entry.second = val;
+            return;
+        }
+
+        // Levels above max_level have gone stale: start's links there skip over every entry.
+        for(size_t i = max_level + 1; i <= level; ++i){
+            start -> span()[i] = skiplist_size + 1;
+        }
+
+        // The new node takes position pos[0] + 1, splitting the links it is inserted into.
+        node_type * new_node = create_node(key, val, level);
         for(size_t i = 0; i <= level; ++i){
-            curr = search_helper(val, i);
-            new_node -> next[i] = curr -> next[i];
-            curr -> next[i] = new_node;
+            new_node -> next[i] = prev[i] -> next[i];
+            prev[i] -> next[i] = new_node;
+            new_node -> span()[i] = prev[i] -> span()[i] - (pos[0] - pos[i]);
+            prev[i] -> span()[i] = pos[0] - pos[i] + 1;
         }
+        for(size_t i = level + 1; i <= max_level; ++i){
+            prev[i] -> span()[i] += 1;
+        }
+        new_node -> prev = prev[0];
+        new_node -> next[0] -> prev = new_node;
+
+        if(level > max_level){
+            max_level = level;
+        }
+        skiplist_size += 1;
     }
 
+    // Links nodes appended in increasing key order after start, at every level of their towers,
+    // keeping the last node and its position at every level. Used to rebuild a skiplist in one pass.
+    struct sorted_builder {
+        node_type * tail[skiplist_max_height + 1];
+        size_t tail_pos[skiplist_max_height + 1];
+        size_t size;
+        size_t top;
+        size_t height;
+
+        sorted_builder(node_type * start) {
+            height = start -> height;
+            for(size_t i = 0; i <= height; ++i){
+                tail[i] = start;
+                tail_pos[i] = 0;
+            }
+            size = 0;
+            top = 0;
+        }
+
+        // Nodes merged from a skiplist with another promotion probability may be taller than start:
+        // they are cut down to its height. Their spans follow the tower, but are all rewritten here.
+        void append(node_type * node) {
+            if(node -> height > height){
+                node -> height = height;
+            }
+            node -> prev = tail[0];
+            size += 1;
+            for(size_t i = 0; i <= node -> height; ++i){
+                tail[i] -> next[i] = node;
+                tail[i] -> span()[i] = size - tail_pos[i];
+                tail[i] = node;
+                tail_pos[i] = size;
+            }
+            if(node -> height > top){
+                top = node -> height;
+            }
+        }
+
+        // Point the last node of every level at end_node.
+        void finish(node_type * end_node) {
+            for(size_t i = 0; i <= height; ++i){
+                tail[i] -> next[i] = end_node;
+                if(i <= top){
+                    tail[i] -> span()[i] = size + 1 - tail_pos[i];
+                }
+            }
+            end_node -> prev = tail[0];
+        }
+    };
+
   public:
-    Skiplist() {
+    typedef std::pair<const KEY, VAL> value_type;
 
-        // Seed rand() according to the current time.
-        srand(time(NULL));
+    // Bidirectional iterator over the entries, in key order.
+    class iterator {
+        node_type * node;
 
-        // Initialize the sentinel nodes.
-        start = new skiplist_node<TYPE>(std::numeric_limits<TYPE>::min(), skiplist_max_height);
-        end = new skiplist_node<TYPE>(std::numeric_limits<TYPE>::max(), skiplist_max_height);
+        friend class Skiplist;
 
-        for(size_t i = 0; i <= skiplist_max_height; ++i)
-        {
-            start -> next[i] = end;
+        explicit iterator(node_type * node) : node(node) {}
+
+      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const KEY, VAL> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type * pointer;
+        typedef value_type & reference;
+
+        iterator() : node(NULL) {}
+
+        const KEY& key() const {
+            return node -> entry.first;
         }
 
-        for(size_t i = 0; i <= skiplist_max_height; ++i)
-        {
-            end -> next[i] = NULL;
+        VAL& value() const {
+            return node -> entry.second;
         }
 
-        // Initialize size.
-        skiplist_size = 0;
+        reference operator*() const {
+            return node -> entry;
+        }
+
+        pointer operator->() const {
+            return &node -> entry;
+        }
+
+        iterator& operator++() {
+            node = node -> next[0];
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            node = node -> next[0];
+            return old;
+        }
+
+        iterator& operator--() {
+            node = node -> prev;
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old = *this;
+            node = node -> prev;
+            return old;
+        }
+
+        bool operator==(const iterator& other) const {
+            return node == other.node;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return node != other.node;
+        }
+    };
+
+    Skiplist(const Compare& comp = Compare()) : Skiplist(0.5, comp) {}
+
+    // A node reaches each level above the bottom one with probability promotion, for example 1/2, 1/4 or 1/e.
+    // Smaller probabilities give shorter towers, so less memory, but longer walks along each level.
+    explicit Skiplist(double promotion, const Compare& comp = Compare()) : comp(comp),
+        levels(promotion, (uint64_t) time(NULL) ^ (uint64_t) reinterpret_cast<uintptr_t>(this)) {
+
+        // Initialize the sentinel nodes.
+        init();
     }
 
-    // Search for a value.
-    bool search(TYPE val){
-        if (search_helper(val, 0) -> val == val) return true;
-        else return false;
+    // The arena frees every node at once.
+    ~Skiplist() {
+        destroy_all();
     }
 
-    // Insert a value.
-    void insert(TYPE val){
+    Skiplist(const Skiplist&) = delete;
+    Skiplist& operator=(const Skiplist&) = delete;
 
-        if(val == std::numeric_limits<TYPE>::min()){
-            throw std::invalid_argument("Cannot insert std::numeric_limits<TYPE>::min() as key. Use any other value.");
+    // Remove all entries. Frees the arena at once, without unlinking nodes one by one.
+    void clear() {
+        destroy_all();
+        arena.clear();
+        init();
+    }
+
+    // Replace the contents with the entries in [first, last), whose keys must be strictly increasing.
+    // Builds every level in one pass: by default, the entry at position i (from 1) gets the number of
+    // times i divides by 1/p (the lowest set bit of i, for p = 1/2), which makes a perfectly balanced
+    // skiplist; with sampled = true, heights are drawn at random like insert() does.
+    template <typename ITERATOR>
+    void from_sorted(ITERATOR first, ITERATOR last, bool sampled = false) {
+        clear();
+
+        sorted_builder builder(start);
+        node_type * prev_node = NULL;
+        for(; first != last; ++first){
+            size_t height = 0;
+            if(sampled){
+                height = levels.next();
+            } else {
+                height = levels.balanced(builder.size + 1);
+            }
+
+            node_type * node = create_node(first -> first, first -> second, height);
+            if(prev_node != NULL and !comp(prev_node -> key(), node -> key())){
+                destroy_node(node);
+                builder.finish(end_node);
+                skiplist_size = builder.size;
+                max_level = builder.top;
+                throw std::invalid_argument("Keys passed to from_sorted() must be strictly increasing.");
+            }
+            builder.append(node);
+            prev_node = node;
         }
 
-        size_t level = 0;
-        // keep flipping a coin!
-        while (level < skiplist_max_height and rand() % 2 == 1){
-            level += 1;
+        builder.finish(end_node);
+        skiplist_size = builder.size;
+        max_level = builder.top;
+    }
+
+    // Move all entries of other into this skiplist, in one pass over both, reusing other's nodes and their
+    // towers. Keys present in both keep the value from this skiplist. other is left empty.
+    void merge(Skiplist& other) {
+        if(&other == this){
+            return;
         }
 
-        insert_upto_level(val, level);
-        skiplist_size += 1;
+        node_type * other_start = other.start;
+        node_type * other_end = other.end_node;
+        arena.absorb(other.arena);
+
+        node_type * a = start -> next[0];
+        node_type * b = other_start -> next[0];
+        sorted_builder builder(start);
+        while(a != end_node or b != other_end){
+            node_type * node;
+            if(b == other_end or (a != end_node and comp(a -> key(), b -> key()))){
+                node = a;
+                a = a -> next[0];
+            } else if(a == end_node or comp(b -> key(), a -> key())){
+                node = b;
+                b = b -> next[0];
+            } else {
+                node = a;
+                a = a -> next[0];
+                node_type * duplicate = b;
+                b = b -> next[0];
+                destroy_node(duplicate);
+            }
+            builder.append(node);
+        }
+
+        builder.finish(end_node);
+        skiplist_size = builder.size;
+        max_level = builder.top;
+
+        // other's sentinels now belong to this arena.
+        destroy_node(other_start);
+        destroy_node(other_end);
+        other.init();
     }
 
-    // Remove a value - one copy only.
-    void remove(TYPE val){
+    // Search for a key.
+    bool search(const KEY& key){
+        node_type * next = lower_node(key, false);
+        return next != end_node and equal(next -> key(), key);
+    }
 
-        skiplist_node<TYPE> * curr = search_helper(val, 0);
+    // Iterator to the entry with this key, or end() if absent.
+    iterator find(const KEY& key){
+        node_type * next = lower_node(key, false);
+        if(next != end_node and equal(next -> key(), key)){
+            return iterator(next);
+        }
+        return end();
+    }
 
-        // val exists in the skiplist.
-        if(curr -> val == val){
+    // Iterator to the first entry whose key is not less than key.
+    iterator lower_bound(const KEY& key){
+        return iterator(lower_node(key, false));
+    }
 
-            int height = curr -> height;
-            int curr_height = height;
-            skiplist_node<TYPE> * prev[height + 1];
-            skiplist_node<TYPE> * prev_node;
+    // Iterator to the first entry whose key is greater than key.
+    iterator upper_bound(const KEY& key){
+        return iterator(lower_node(key, true));
+    }
 
-            prev_node = start;
-            while(curr_height >= 0){
+    iterator begin(){
+        return iterator(start -> next[0]);
+    }
 
-                while(prev_node -> next[curr_height] != curr){
-                    prev_node = prev_node -> next[curr_height];
-                }
+    iterator end(){
+        return iterator(end_node);
+    }
 
-                while((curr_height >= 0) and (prev_node -> next[curr_height]  == curr)){
-                    prev[curr_height] = prev_node;
-                    curr_height -= 1;
-                }
+    // Calls visit(key, val) on every entry with lo <= key < hi, in key order, and returns their number.
+    // One descent finds lo; the walk along level 0 then prefetches the node after next.
+    template <typename FUNC>
+    size_t range(const KEY& lo, const KEY& hi, FUNC visit){
+        size_t visited = 0;
+        node_type * curr = lower_node(lo, false);
+        while(curr != end_node and comp(curr -> key(), hi)){
+            skiplist_prefetch(curr -> next[0] -> next[0]);
+            visit(curr -> entry.first, curr -> entry.second);
+            visited += 1;
+            curr = curr -> next[0];
+        }
+        return visited;
+    }
+
+    // Insert a key with its value, overwriting the value if the key is already present.
+    void insert(const KEY& key, const VAL& val){
+
+        insert_upto_level(key, val, levels.next());
+    }
+
+    // Remove a key.
+    void remove(const KEY& key){
+
+        node_type * prev[skiplist_max_height + 1];
+        size_t pos[skiplist_max_height + 1];
+        find_predecessors(key, prev, pos);
+        node_type * curr = prev[0] -> next[0];
+
+        // key is not present in the skiplist
+        if(curr == end_node or !equal(curr -> key(), key)){
+            throw std::invalid_argument("Key not found in skiplist. Cannot delete.");
+        }
+
+        // curr follows the predecessors at every level it is on.
+        for(size_t i = 0; i <= curr -> height; ++i){
+            prev[i] -> next[i] = curr -> next[i];
+            prev[i] -> span()[i] += curr -> span()[i] - 1;
+        }
+        for(size_t i = curr -> height + 1; i <= max_level; ++i){
+            prev[i] -> span()[i] -= 1;
+        }
+        curr -> next[0] -> prev = prev[0];
+
+        destroy_node(curr);
+        skiplist_size -= 1;
+
+        // Lower the starting level past emptied levels.
+        while(max_level > 0 and start -> next[max_level] == end_node){
+            max_level -= 1;
+        }
+    }
+
+    // Number of keys less than key, which is the rank of key if present.
+    size_t rank(const KEY& key){
+
+        node_type * curr = start;
+        size_t curr_pos = 0;
+        size_t level = max_level;
+        while(true){
+            node_type * next = curr -> next[level];
+            while(next != end_node and comp(next -> key(), key)){
+                curr_pos += curr -> span()[level];
+                curr = next;
+                next = curr -> next[level];
             }
 
-            // Update the previous nodes at every level.
-            for(size_t i = 0; i <= height; ++i){
-                prev[i] -> next[i] = curr -> next[i];
+            if(level == 0){
+                return curr_pos;
+            }
+            level -= 1;
+        }
+    }
+
+    // Iterator to the entry of rank index, counting from 0, or end() if index >= size().
+    iterator select(size_t index){
+        if(index >= skiplist_size){
+            return end();
+        }
+
+        node_type * prev[skiplist_max_height + 1];
+        size_t pos[skiplist_max_height + 1];
+        find_position(index + 1, prev, pos);
+        return iterator(prev[0]);
+    }
+
+    // Remove the entries with ranks first to last - 1, in one descent plus one walk over the removed nodes.
+    void erase_range_by_rank(size_t first, size_t last){
+        if(last > skiplist_size){
+            last = skiplist_size;
+        }
+        if(first >= last){
+            return;
+        }
+        size_t count = last - first;
+
+        // Last nodes kept before the range, and last nodes in the range, at every level.
+        node_type * prev[skiplist_max_height + 1];
+        size_t pos[skiplist_max_height + 1];
+        node_type * last_prev[skiplist_max_height + 1];
+        size_t last_pos[skiplist_max_height + 1];
+        find_position(first, prev, pos);
+        find_position(last, last_prev, last_pos);
+
+        for(size_t i = 0; i <= max_level; ++i){
+            if(last_prev[i] == prev[i]){
+                prev[i] -> span()[i] -= count;
+            } else {
+                prev[i] -> next[i] = last_prev[i] -> next[i];
+                prev[i] -> span()[i] = last_pos[i] + last_prev[i] -> span()[i] - pos[i] - count;
             }
+        }
 
-            delete curr;
-            skiplist_size -= 1;
+        node_type * curr = last_prev[0];
+        curr -> next[0] -> prev = prev[0];
+        for(size_t i = 0; i < count; ++i){
+            node_type * before = curr -> prev;
+            destroy_node(curr);
+            curr = before;
+        }
+        skiplist_size -= count;
 
+        // Lower the starting level past emptied levels.
+        while(max_level > 0 and start -> next[max_level] == end_node){
+            max_level -= 1;
         }
-        // val is not present in the skiplist
-        else throw std::invalid_argument("Value not found in skiplist. Cannot delete.");
     }
 
     size_t size(){
         return skiplist_size;
     }
 
+    // Promotion probability, as passed to the constructor.
+    double get_promotion(){
+        return levels.get_promotion();
+    }
+
+    // Bytes of node memory, sentinels and freed nodes included.
+    size_t get_memory_usage(){
+        return arena.get_allocated_bytes();
+    }
+
     friend std::ostream& operator<< <>(std::ostream& os, const Skiplist& sl);
 
 };
 
-// Overload the << operator for printing
-template <typename TYPE>
-std::ostream &operator<<(std::ostream &os, Skiplist<TYPE> const &sl)
+// Overload the << operator for printing the keys
+template <typename KEY, typename VAL, typename Compare>
+std::ostream &operator<<(std::ostream &os, Skiplist<KEY, VAL, Compare> const &sl)
 {
-    skiplist_node<TYPE> * curr;
+    skiplist_node<KEY, VAL> * curr;
 
     os << "---\n";
-    for(size_t level = 0; level <= skiplist_max_height; ++level)
+    for(size_t level = 0; level <= sl.start -> height; ++level)
     {
         os << "Skiplist Level " << level << ":" << '\n';
 
         curr = sl.start -> next[level];
-        if(curr == sl.end)
+        if(curr == sl.end_node)
         {
             os << "Skiplist empty from here and above." << "\n---\n";
             break;
         }
 
-        while(curr != sl.end)
+        while(curr != sl.end_node)
         {
-            os << curr -> val << " ";
+            os << curr -> key() << " ";
             curr = curr -> next[level];
         }
 
@@ -223,3 +887,5 @@ std::ostream &operator<<(std::ostream &os, Skiplist<TYPE> const &sl)
 
     return os;
 }
+
+#endif
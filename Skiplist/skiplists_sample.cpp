@@ -7,24 +7,35 @@ A driver program for the 'skiplist.hpp' library.
 
 #include <iostream>
 #include <cstdlib>
+#include <vector>
+#include <thread>
+#include <string>
+#include <functional>
+#include <memory>
+#include <map>
+#include <set>
+#include <iterator>
+#include <cassert>
 #include "skiplist.hpp"
+#include "concurrent_skiplist.hpp"
+#include "unrolled_skiplist.hpp"
 
 using namespace std;
 int main()
 {
-    Skiplist<int> sl_integer;
-    Skiplist<double> sl_double;
+    Skiplist<int, int> sl_integer;
+    Skiplist<double, int> sl_double;
 
-    // Insert a 100 random integers in the range 0 to 999.
+    // Insert a 100 distinct random integers in the range 0 to 999, each mapped to its position.
     int integers[100];
     double doubles[100];
     for(int i = 0; i < 100; ++i)
     {
-        integers[i] = (rand() % 1000);
+        integers[i] = (rand() % 10) * 100 + i;
         doubles[i] = (double) rand() / (double) RAND_MAX;
 
-        sl_integer.insert(integers[i]);
-        sl_double.insert(doubles[i]);
+        sl_integer.insert(integers[i], i);
+        sl_double.insert(doubles[i], i);
     }
 
     // Print the list - the '<<' operator has been overloaded!
@@ -53,9 +64,112 @@ int main()
     // Print the skiplist again.
     cout << sl_integer;
 
+    // Walk the keys in order, forwards with iterators and backwards from the end.
+    int previous = -1;
+    for(Skiplist<int, int>::iterator it = sl_integer.begin(); it != sl_integer.end(); ++it)
+    {
+        if(it -> first <= previous or integers[it -> second] != it -> first)
+        {
+            cout << "Something's wrong." << '\n';
+        }
+        previous = it -> first;
+    }
+    Skiplist<int, int>::iterator last = sl_integer.end();
+    --last;
+    cout << "Largest key " << last.key() << ", first key from 500 " << sl_integer.lower_bound(500).key() << '\n';
+
+    // Visit the keys in [200, 400) in one pass.
+    size_t in_range = sl_integer.range(200, 400, [](int key, int val)
+    {
+        cout << key << ":" << val << " ";
+    });
+    cout << '\n' << in_range << " keys in [200, 400)." << '\n';
+
+    // Ranks: the position of a key in order, and the key at a position.
+    size_t median = sl_integer.size() / 2;
+    cout << "Median key " << sl_integer.select(median).key() << " has rank " << sl_integer.rank(sl_integer.select(median).key()) << '\n';
+
+    // Drop the 10 smallest keys.
+    sl_integer.erase_range_by_rank(0, 10);
+    cout << sl_integer.size() << " elements after dropping the 10 smallest, now starting at " << sl_integer.begin().key() << '\n';
+
+    // Check rank(), select() and erase_range_by_rank() against a std::map, through random inserts, removes and range erases.
+    for(double promotion : {0.5, 0.25})
+    {
+        Skiplist<int, int> sl_ranked(promotion);
+        map<int, int> reference;
+        for(int i = 0; i < 50000; ++i)
+        {
+            int key = rand() % 4000;
+            int op = rand() % 10;
+            if(op < 5)
+            {
+                sl_ranked.insert(key, i);
+                reference[key] = i;
+            }
+            else if(op < 7)
+            {
+                if(reference.count(key))
+                {
+                    sl_ranked.remove(key);
+                    reference.erase(key);
+                }
+            }
+            else if(op == 7)
+            {
+                assert(sl_ranked.rank(key) == (size_t) distance(reference.begin(), reference.lower_bound(key)));
+            }
+            else if(op == 8)
+            {
+                size_t index = rand() % (reference.size() + 2);
+                if(index >= reference.size())
+                {
+                    assert(sl_ranked.select(index) == sl_ranked.end());
+                }
+                else
+                {
+                    assert(sl_ranked.select(index).key() == next(reference.begin(), index) -> first);
+                }
+            }
+            else if(rand() % 20 == 0)
+            {
+                size_t first = rand() % (reference.size() + 1);
+                size_t last = first + rand() % 30;
+                sl_ranked.erase_range_by_rank(first, last);
+                last = min(last, reference.size());
+                reference.erase(next(reference.begin(), first), next(reference.begin(), last));
+            }
+
+            // Every so often, check every position, and walk the keys backwards.
+            if(i % 5000 == 0)
+            {
+                assert(sl_ranked.size() == reference.size());
+                size_t position = 0;
+                for(map<int, int>::iterator it = reference.begin(); it != reference.end(); ++it, ++position)
+                {
+                    assert(sl_ranked.select(position).key() == it -> first and sl_ranked.select(position).value() == it -> second);
+                    assert(sl_ranked.rank(it -> first) == position);
+                }
+                Skiplist<int, int>::iterator it = sl_ranked.end();
+                for(map<int, int>::reverse_iterator ref = reference.rbegin(); ref != reference.rend(); ++ref)
+                {
+                    --it;
+                    assert(it.key() == ref -> first);
+                }
+            }
+        }
+        sl_ranked.erase_range_by_rank(0, sl_ranked.size());
+        assert(sl_ranked.size() == 0 and sl_ranked.begin() == sl_ranked.end());
+    }
+    cout << "Rank, select and erase_range_by_rank match std::map, as expected." << '\n';
+
     // Delete all the remaining integers.
     for(int i = 50; i < 100; ++i)
     {
+        if(!sl_integer.search(integers[i]))
+        {
+            continue;
+        }
         sl_integer.remove(integers[i]);
         cout << "removed " << i << " " << integers[i] << "\n";
 
@@ -64,5 +178,224 @@ int main()
     // Print the empty skiplist.
     cout << sl_integer;
 
+    // Refill the skiplist, then empty it at once.
+    for(int i = 0; i < 1000; ++i)
+    {
+        sl_integer.insert(rand() % 1000, i);
+    }
+    sl_integer.clear();
+    sl_integer.insert(7, 0);
+    cout << sl_integer.size() << " element in skiplist after clear()." << '\n';
+
+    // Build a skiplist from sorted pairs in one pass, then merge another one into it.
+    vector<pair<int, int>> squares;
+    for(int i = 0; i < 20; ++i)
+    {
+        squares.push_back(make_pair(i * i, i));
+    }
+    Skiplist<int, int> sl_squares, sl_cubes;
+    sl_squares.from_sorted(squares.begin(), squares.end());
+    for(int i = 0; i < 8; ++i)
+    {
+        sl_cubes.insert(i * i * i, i);
+    }
+    sl_squares.merge(sl_cubes);
+    cout << sl_squares.size() << " squares and cubes, " << sl_cubes.size() << " left in the merged skiplist." << '\n';
+
+    // Merge a skiplist with taller towers (promotion probability 1/2) into one with shorter ones (1/8).
+    Skiplist<int, int> sl_short(0.125), sl_tall(0.5);
+    for(int i = 0; i < 20000; ++i)
+    {
+        sl_short.insert(2 * i, i);
+        sl_tall.insert(2 * i + 1, i);
+    }
+    sl_short.merge(sl_tall);
+    bool merged_ok = sl_short.size() == 40000;
+    for(int i = 0; i < 40000; i += 997)
+    {
+        merged_ok = merged_ok and sl_short.rank(i) == (size_t) i and sl_short.select(i).key() == i;
+    }
+    for(int i = 0; i < 40000; i += 3)
+    {
+        sl_short.remove(i);
+    }
+    merged_ok = merged_ok and sl_short.size() == 26666 and sl_short.search(1) and !sl_short.search(3);
+    cout << sl_short.size() << " elements after merging skiplists with different promotion probabilities, "
+         << (merged_ok ? "as expected." : "something's wrong.") << '\n';
+
+    // Promote nodes with probability 1/4 rather than 1/2: shorter towers, so less memory.
+    Skiplist<int, int> sl_sparse(0.25);
+    for(int i = 0; i < 1000; ++i)
+    {
+        sl_sparse.insert(i, i * i);
+    }
+    cout << sl_sparse.size() << " elements in skiplist with promotion probability " << sl_sparse.get_promotion() << ", "
+         << (sl_sparse.find(30).value() == 900 and sl_sparse.rank(30) == 30 ? "as expected." : "something's wrong.") << '\n';
+
+    // Keys in decreasing order, with string values overwritten by a second insert.
+    Skiplist<string, string, greater<string>> sl_names;
+    sl_names.insert("ameya", "daigavane");
+    sl_names.insert("skip", "list");
+    sl_names.insert("ameya", "overwritten");
+    for(Skiplist<string, string, greater<string>>::iterator it = sl_names.begin(); it != sl_names.end(); ++it)
+    {
+        cout << it -> first << " -> " << it -> second << '\n';
+    }
+
+    // An unrolled skiplist keeps many keys per node, splitting and merging nodes as keys come and go.
+    UnrolledSkiplist<int, int> sl_unrolled;
+    for(int i = 0; i < 1000; ++i)
+    {
+        sl_unrolled.insert((i * 7919) % 1000, i);
+    }
+    for(int i = 0; i < 1000; i += 3)
+    {
+        sl_unrolled.remove(i);
+    }
+    int unrolled_sum = 0;
+    size_t unrolled_visited = sl_unrolled.range(100, 200, [&unrolled_sum](int key, int)
+    {
+        unrolled_sum += key;
+    });
+    cout << sl_unrolled.size() << " elements in " << sl_unrolled.get_num_nodes() << " nodes of unrolled skiplist, "
+         << unrolled_visited << " of them in [100, 200), "
+         << (sl_unrolled.search(101) and !sl_unrolled.search(102) and unrolled_sum == 10000 ? "as expected." : "something's wrong.") << '\n';
+
+    // Random inserts and removes on small nodes, whose keys do not all sort after KEY(): in decreasing order,
+    // and negative. Emptied nodes in the middle must be unlinked alone, without losing their neighbours.
+    UnrolledSkiplist<string, int, greater<string>> sl_names_unrolled;
+    set<string, greater<string>> names_reference;
+    UnrolledSkiplist<int, int, less<int>, 4> sl_negative;
+    set<int> negative_reference;
+    for(int i = 0; i < 20000; ++i)
+    {
+        string name = "key" + to_string(rand() % 300);
+        int negative = -(rand() % 300) - 1;
+        if(rand() % 2)
+        {
+            sl_names_unrolled.insert(name, i);
+            names_reference.insert(name);
+            sl_negative.insert(negative, i);
+            negative_reference.insert(negative);
+        }
+        else
+        {
+            if(names_reference.erase(name))
+            {
+                sl_names_unrolled.remove(name);
+            }
+            if(negative_reference.erase(negative))
+            {
+                sl_negative.remove(negative);
+            }
+        }
+
+        if(i % 100 == 0)
+        {
+            assert(sl_names_unrolled.size() == names_reference.size() and sl_negative.size() == negative_reference.size());
+            set<string, greater<string>>::iterator name = names_reference.begin();
+            for(UnrolledSkiplist<string, int, greater<string>>::iterator it = sl_names_unrolled.begin(); it != sl_names_unrolled.end(); ++it, ++name)
+            {
+                assert(name != names_reference.end() and it.key() == *name);
+            }
+            assert(name == names_reference.end());
+            set<int>::iterator negative_key = negative_reference.begin();
+            for(UnrolledSkiplist<int, int, less<int>, 4>::iterator it = sl_negative.begin(); it != sl_negative.end(); ++it, ++negative_key)
+            {
+                assert(negative_key != negative_reference.end() and it.key() == *negative_key);
+            }
+            assert(negative_key == negative_reference.end());
+        }
+    }
+    cout << sl_names_unrolled.size() << " and " << sl_negative.size() << " elements in unrolled skiplists with small nodes match std::set, as expected." << '\n';
+
+    // Removed values are released at once, not when their node is freed.
+    shared_ptr<int> shared_value(new int(7));
+    UnrolledSkiplist<int, shared_ptr<int>> sl_sharers;
+    for(int i = 0; i < 20; ++i)
+    {
+        sl_sharers.insert(i, shared_value);
+    }
+    for(int i = 19; i >= 0; i -= 2)
+    {
+        sl_sharers.remove(i);
+    }
+    cout << shared_value.use_count() - 1 << " references left in unrolled skiplist of " << sl_sharers.size() << " elements, "
+         << (shared_value.use_count() == 11 ? "as expected." : "something's wrong.") << '\n';
+
+    // Share a concurrent skiplist between threads, each inserting its own values, then removing every other one.
+    ConcurrentSkiplist<int> sl_shared;
+    vector<thread> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+        threads.push_back(thread([&sl_shared, t]()
+        {
+            for(int i = 0; i < 10000; ++i)
+            {
+                sl_shared.insert(t * 10000 + i);
+            }
+            for(int i = 0; i < 10000; i += 2)
+            {
+                sl_shared.remove(t * 10000 + i);
+            }
+        }));
+    }
+    for(int t = 0; t < 4; ++t)
+    {
+        threads[t].join();
+    }
+    cout << sl_shared.size() << " elements in concurrent skiplist, "
+         << (sl_shared.search(1) and !sl_shared.search(2) ? "as expected." : "something's wrong.") << '\n';
+
+    // Contend on a few keys: every thread inserts, removes and searches the same 64 values, counting the
+    // inserts and removes which succeeded. Each value must end up present exactly when its inserts outnumber
+    // its removes, which can then only be by one.
+    ConcurrentSkiplist<int> sl_contended;
+    vector<vector<int>> net_inserts(4, vector<int>(64, 0));
+    vector<thread> contenders;
+    for(int t = 0; t < 4; ++t)
+    {
+        contenders.push_back(thread([&sl_contended, &net_inserts, t]()
+        {
+            unsigned int state = t + 1;
+            for(int i = 0; i < 50000; ++i)
+            {
+                state = state * 1103515245 + 12345;
+                int val = (state >> 16) % 64;
+                int op = (state >> 8) % 3;
+                if(op == 0)
+                {
+                    net_inserts[t][val] += sl_contended.insert(val);
+                }
+                else if(op == 1)
+                {
+                    net_inserts[t][val] -= sl_contended.remove(val);
+                }
+                else
+                {
+                    sl_contended.search(val);
+                }
+            }
+        }));
+    }
+    for(int t = 0; t < 4; ++t)
+    {
+        contenders[t].join();
+    }
+    size_t contended_present = 0;
+    for(int val = 0; val < 64; ++val)
+    {
+        int net = 0;
+        for(int t = 0; t < 4; ++t)
+        {
+            net += net_inserts[t][val];
+        }
+        assert(net == 0 or net == 1);
+        assert(sl_contended.search(val) == (net == 1));
+        contended_present += net;
+    }
+    assert(sl_contended.size() == contended_present);
+    cout << contended_present << " of 64 contended values left in concurrent skiplist, as expected." << '\n';
+
     cout << "Tests finished!" << "\n";
 }
@@ -0,0 +1,587 @@
+/*
+Unrolled Skiplists in C++
+Author: Ameya Daigavane
+A cache-conscious variant of Skiplist, where every node holds a small sorted array of up to NODE_KEYS entries,
+by default about two cache lines of keys. Towers index nodes by their first key, so a search descends to the
+right node, then scans its keys without branching. Walking the bottom list visits a node per NODE_KEYS entries
+instead of one per entry. Nodes split in half when full, and merge with, or borrow from, their successor when
+less than a quarter full.
+*/
+
+#ifndef UNROLLED_SKIPLIST_HPP
+#define UNROLLED_SKIPLIST_HPP
+
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <new>
+#include <utility>
+#include <iterator>
+#include <functional>
+#include <type_traits>
+#include "skiplist.hpp"
+
+// Like skiplist_node, the tower of next pointers is laid out inline after the node, which is allocated
+// with room for height + 1 pointers by skiplist_arena. The keys follow the tower and the values follow
+// the keys, so that a search reads a node's height, link and first key from the same cache line.
+template <typename KEY, typename VAL, size_t NODE_KEYS>
+struct unrolled_skiplist_node {
+
+    alignas(size_t) alignas(KEY) alignas(VAL) size_t height;
+    size_t count;
+    unrolled_skiplist_node * prev;
+    unrolled_skiplist_node * next[1];
+
+    unrolled_skiplist_node(size_t inp_height) {
+        height = inp_height;
+        count = 0;
+        prev = NULL;
+
+        KEY * node_keys = keys();
+        VAL * node_vals = vals();
+        for(size_t i = 0; i < NODE_KEYS; ++i){
+            new (node_keys + i) KEY();
+            new (node_vals + i) VAL();
+        }
+    }
+
+    ~unrolled_skiplist_node() {
+        KEY * node_keys = keys();
+        VAL * node_vals = vals();
+        for(size_t i = 0; i < NODE_KEYS; ++i){
+            node_keys[i].~KEY();
+            node_vals[i].~VAL();
+        }
+    }
+
+    static size_t align(size_t offset, size_t alignment){
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    static size_t keys_offset(size_t height){
+        return align(sizeof(unrolled_skiplist_node) + height * sizeof(unrolled_skiplist_node *), alignof(KEY));
+    }
+
+    static size_t vals_offset(size_t height){
+        return align(keys_offset(height) + NODE_KEYS * sizeof(KEY), alignof(VAL));
+    }
+
+    // Bytes needed for a node with a tower of height + 1 pointers, and its keys and values.
+    static size_t bytes(size_t height){
+        return align(vals_offset(height) + NODE_KEYS * sizeof(VAL), alignof(unrolled_skiplist_node));
+    }
+
+    KEY * keys() {
+        return reinterpret_cast<KEY *>(reinterpret_cast<char *>(this) + keys_offset(height));
+    }
+
+    const KEY * keys() const {
+        return reinterpret_cast<const KEY *>(reinterpret_cast<const char *>(this) + keys_offset(height));
+    }
+
+    VAL * vals() {
+        return reinterpret_cast<VAL *>(reinterpret_cast<char *>(this) + vals_offset(height));
+    }
+
+};
+
+template <typename KEY, typename VAL, typename Compare = std::less<KEY>,
+          size_t NODE_KEYS = (128 / sizeof(KEY) >= 4 ? 128 / sizeof(KEY) : 4)>
+class UnrolledSkiplist {
+
+    static_assert(NODE_KEYS >= 4, "UnrolledSkiplist needs at least 4 keys per node.");
+
+  private:
+    typedef unrolled_skiplist_node<KEY, VAL, NODE_KEYS> node_type;
+
+    static_assert(alignof(node_type) <= alignof(std::max_align_t), "skiplist_arena does not over-align nodes.");
+
+    // Sentinel nodes - start and end. They hold no keys.
+    node_type * start;
+    node_type * end_node;
+
+    // Number of entries, and of nodes holding them.
+    size_t skiplist_size;
+    size_t num_nodes;
+
+    // Highest level holding any node, where searches start. 0 when empty.
+    size_t max_level;
+
+    Compare comp;
+
+    // Heights of new nodes. Also caps the height of the sentinels.
+    skiplist_level_generator levels;
+
+    // Memory for all nodes, sentinels included.
+    skiplist_arena<node_type> arena;
+
+    node_type * create_node(size_t height) {
+        num_nodes += 1;
+        return new (arena.allocate(height)) node_type(height);
+    }
+
+    void destroy_node(node_type * node) {
+        size_t height = node -> height;
+        node -> ~node_type();
+        arena.release(node, height);
+        num_nodes -= 1;
+    }
+
+    // Destroy all nodes, sentinels included. Nothing to do for trivially destructible types.
+    void destroy_all() {
+        if(std::is_trivially_destructible<KEY>::value and std::is_trivially_destructible<VAL>::value){
+            return;
+        }
+
+        node_type * curr = start;
+        while(curr != NULL){
+            node_type * next = curr -> next[0];
+            curr -> ~node_type();
+            curr = next;
+        }
+    }
+
+    // Create empty sentinels.
+    void init() {
+        num_nodes = 0;
+        start = create_node(levels.get_max_height());
+        end_node = create_node(levels.get_max_height());
+        num_nodes = 0;
+
+        for(size_t i = 0; i <= start -> height; ++i){
+            start -> next[i] = end_node;
+            end_node -> next[i] = NULL;
+        }
+        end_node -> prev = start;
+
+        skiplist_size = 0;
+        max_level = 0;
+    }
+
+    // find_predecessors(key, prev, strict):
+    // fills prev[level] with the last node at that level whose first key is at most key (or less than key,
+    // when strict), in a single descent from the highest occupied level. prev[0] is then the node whose
+    // keys span key, or start if key precedes every key.
+    void find_predecessors(const KEY& key, node_type ** prev, bool strict) {
+
+        node_type * curr = start;
+
+        for(size_t level = start -> height; level > max_level; --level){
+            prev[level] = start;
+        }
+
+        size_t level = max_level;
+        while(true){
+            node_type * next = curr -> next[level];
+            while(next != end_node and (strict ? comp(next -> keys()[0], key) : !comp(key, next -> keys()[0]))){
+                curr = next;
+                next = curr -> next[level];
+            }
+            prev[level] = curr;
+
+            if(level == 0){
+                break;
+            }
+            level -= 1;
+        }
+    }
+
+    // The node whose keys span key, or start if key precedes every key, without recording predecessors.
+    node_type * find_node(const KEY& key) const {
+
+        node_type * curr = start;
+        size_t level = max_level;
+        while(true){
+            node_type * next = curr -> next[level];
+            while(next != end_node and !comp(key, next -> keys()[0])){
+                curr = next;
+                next = curr -> next[level];
+            }
+
+            if(level == 0){
+                return curr;
+            }
+            level -= 1;
+        }
+    }
+
+    // Number of keys of node less than key (strict = false), or not greater than key (strict = true).
+    // Adds up comparisons instead of branching on them.
+    size_t rank_in_node(const node_type * node, const KEY& key, bool strict) const {
+        const KEY * node_keys = node -> keys();
+        size_t count = node -> count;
+        size_t rank = 0;
+        if(strict){
+            for(size_t i = 0; i < count; ++i){
+                rank += !comp(key, node_keys[i]);
+            }
+        } else {
+            for(size_t i = 0; i < count; ++i){
+                rank += comp(node_keys[i], key);
+            }
+        }
+        return rank;
+    }
+
+    bool equal(const KEY& a, const KEY& b) const {
+        return !comp(a, b) and !comp(b, a);
+    }
+
+    // Link node after prev[level] at every level of its tower.
+    void link_node(node_type * node, node_type ** prev) {
+        for(size_t i = 0; i <= node -> height; ++i){
+            node -> next[i] = prev[i] -> next[i];
+            prev[i] -> next[i] = node;
+        }
+        node -> prev = prev[0];
+        node -> next[0] -> prev = node;
+
+        if(node -> height > max_level){
+            max_level = node -> height;
+        }
+    }
+
+    // Unlink and free node, given the last node before it at every level.
+    void unlink_node(node_type * node, node_type ** prev) {
+        for(size_t i = 0; i <= node -> height; ++i){
+            prev[i] -> next[i] = node -> next[i];
+        }
+        node -> next[0] -> prev = node -> prev;
+        destroy_node(node);
+
+        // Lower the starting level past emptied levels.
+        while(max_level > 0 and start -> next[max_level] == end_node){
+            max_level -= 1;
+        }
+    }
+
+    // Reset the slots first to last - 1 of node, past its entries, so that whatever their keys and values
+    // own is released now rather than when the slots are reused or the node is freed.
+    void clear_slots(node_type * node, size_t first, size_t last) {
+        for(size_t i = first; i < last; ++i){
+            node -> keys()[i] = KEY();
+            node -> vals()[i] = VAL();
+        }
+    }
+
+    // Move the upper half of a full node to a new node linked after it, given node's predecessors.
+    node_type * split_node(node_type * node, node_type ** prev) {
+        node_type * upper = create_node(levels.next());
+        size_t half = NODE_KEYS / 2;
+        for(size_t i = half; i < NODE_KEYS; ++i){
+            upper -> keys()[i - half] = std::move(node -> keys()[i]);
+            upper -> vals()[i - half] = std::move(node -> vals()[i]);
+        }
+        upper -> count = NODE_KEYS - half;
+        node -> count = half;
+        clear_slots(node, half, NODE_KEYS);
+
+        // The upper half follows node at every level: its predecessors are node's, or node itself.
+        node_type * upper_prev[skiplist_max_height + 1];
+        for(size_t i = 0; i <= upper -> height; ++i){
+            upper_prev[i] = i <= node -> height ? node : prev[i];
+        }
+        link_node(upper, upper_prev);
+        return upper;
+    }
+
+    // Insert key at position slot of node, which has room for it.
+    void insert_into_node(node_type * node, size_t slot, const KEY& key, const VAL& val) {
+        for(size_t i = node -> count; i > slot; --i){
+            node -> keys()[i] = std::move(node -> keys()[i - 1]);
+            node -> vals()[i] = std::move(node -> vals()[i - 1]);
+        }
+        node -> keys()[slot] = key;
+        node -> vals()[slot] = val;
+        node -> count += 1;
+    }
+
+    // Refill a node which fell under a quarter full from its successor: merge both when they fit in
+    // three quarters of a node, otherwise move keys over until both are about half full.
+    // The last node has no successor, and is left as it is.
+    void rebalance(node_type * node) {
+        node_type * prev[skiplist_max_height + 1];
+        node_type * next = node -> next[0];
+        if(next == end_node){
+            return;
+        }
+
+        if(node -> count + next -> count <= NODE_KEYS * 3 / 4){
+            find_predecessors(next -> keys()[0], prev, true);
+            for(size_t i = 0; i < next -> count; ++i){
+                node -> keys()[node -> count + i] = std::move(next -> keys()[i]);
+                node -> vals()[node -> count + i] = std::move(next -> vals()[i]);
+            }
+            node -> count += next -> count;
+            unlink_node(next, prev);
+        } else {
+            size_t moved = (next -> count - node -> count) / 2;
+            for(size_t i = 0; i < moved; ++i){
+                node -> keys()[node -> count + i] = std::move(next -> keys()[i]);
+                node -> vals()[node -> count + i] = std::move(next -> vals()[i]);
+            }
+            for(size_t i = moved; i < next -> count; ++i){
+                next -> keys()[i - moved] = std::move(next -> keys()[i]);
+                next -> vals()[i - moved] = std::move(next -> vals()[i]);
+            }
+            node -> count += moved;
+            next -> count -= moved;
+            clear_slots(next, next -> count, next -> count + moved);
+        }
+    }
+
+  public:
+    // Bidirectional iterator over the entries, in key order: a node and a slot in it.
+    class iterator {
+        node_type * node;
+        size_t slot;
+
+        friend class UnrolledSkiplist;
+
+        iterator(node_type * node, size_t slot) : node(node), slot(slot) {}
+
+      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const KEY&, VAL&> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef value_type reference;
+
+        iterator() : node(NULL), slot(0) {}
+
+        const KEY& key() const {
+            return node -> keys()[slot];
+        }
+
+        VAL& value() const {
+            return node -> vals()[slot];
+        }
+
+        reference operator*() const {
+            return reference(node -> keys()[slot], node -> vals()[slot]);
+        }
+
+        iterator& operator++() {
+            slot += 1;
+            if(slot >= node -> count and node -> next[0] != NULL){
+                node = node -> next[0];
+                slot = 0;
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        iterator& operator--() {
+            if(slot == 0){
+                node = node -> prev;
+                slot = node -> count;
+            }
+            slot -= 1;
+            return *this;
+        }
+
+        iterator operator--(int) {
+            iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const iterator& other) const {
+            return node == other.node and slot == other.slot;
+        }
+
+        bool operator!=(const iterator& other) const {
+            return !(*this == other);
+        }
+    };
+
+    UnrolledSkiplist(const Compare& comp = Compare()) : UnrolledSkiplist(0.5, comp) {}
+
+    // A node reaches each level above the bottom one with probability promotion, as for Skiplist.
+    explicit UnrolledSkiplist(double promotion, const Compare& comp = Compare()) : comp(comp),
+        levels(promotion, (uint64_t) time(NULL) ^ (uint64_t) reinterpret_cast<uintptr_t>(this)) {
+        init();
+    }
+
+    // The arena frees every node at once.
+    ~UnrolledSkiplist() {
+        destroy_all();
+    }
+
+    UnrolledSkiplist(const UnrolledSkiplist&) = delete;
+    UnrolledSkiplist& operator=(const UnrolledSkiplist&) = delete;
+
+    // Remove all entries. Frees the arena at once.
+    void clear() {
+        destroy_all();
+        arena.clear();
+        init();
+    }
+
+    // Search for a key.
+    bool search(const KEY& key) {
+        return find(key) != end();
+    }
+
+    // Iterator to the entry with this key, or end() if absent.
+    iterator find(const KEY& key) {
+        node_type * node = find_node(key);
+        if(node == start){
+            return end();
+        }
+
+        size_t slot = rank_in_node(node, key, false);
+        if(slot < node -> count and equal(node -> keys()[slot], key)){
+            return iterator(node, slot);
+        }
+        return end();
+    }
+
+    // Iterator to the first entry whose key is not less than key.
+    iterator lower_bound(const KEY& key) {
+        node_type * node = find_node(key);
+        if(node == start){
+            return begin();
+        }
+
+        iterator it(node, rank_in_node(node, key, false));
+        if(it.slot == node -> count){
+            it.node = node -> next[0];
+            it.slot = 0;
+        }
+        return it;
+    }
+
+    // Iterator to the first entry whose key is greater than key.
+    iterator upper_bound(const KEY& key) {
+        node_type * node = find_node(key);
+        if(node == start){
+            return begin();
+        }
+
+        iterator it(node, rank_in_node(node, key, true));
+        if(it.slot == node -> count){
+            it.node = node -> next[0];
+            it.slot = 0;
+        }
+        return it;
+    }
+
+    iterator begin() {
+        return iterator(start -> next[0], 0);
+    }
+
+    iterator end() {
+        return iterator(end_node, 0);
+    }
+
+    // Calls visit(key, val) on every entry with lo <= key < hi, in key order, and returns their number.
+    // One descent finds lo; the walk then scans whole nodes, prefetching the next one.
+    template <typename FUNC>
+    size_t range(const KEY& lo, const KEY& hi, FUNC visit) {
+        size_t visited = 0;
+        iterator it = lower_bound(lo);
+        node_type * node = it.node;
+        size_t slot = it.slot;
+
+        while(node != end_node){
+            skiplist_prefetch(node -> next[0]);
+            KEY * node_keys = node -> keys();
+            VAL * node_vals = node -> vals();
+            for(; slot < node -> count; ++slot){
+                if(!comp(node_keys[slot], hi)){
+                    return visited;
+                }
+                visit(node_keys[slot], node_vals[slot]);
+                visited += 1;
+            }
+            node = node -> next[0];
+            slot = 0;
+        }
+        return visited;
+    }
+
+    // Insert a key with its value, overwriting the value if the key is already present.
+    void insert(const KEY& key, const VAL& val) {
+        node_type * prev[skiplist_max_height + 1];
+        find_predecessors(key, prev, false);
+        node_type * node = prev[0];
+
+        // A key before every other goes to the front of the first node.
+        if(node == start){
+            node = start -> next[0];
+            if(node == end_node){
+                node = create_node(levels.next());
+                link_node(node, prev);
+            }
+        }
+
+        size_t slot = rank_in_node(node, key, false);
+        if(slot < node -> count and equal(node -> keys()[slot], key)){
+            node -> vals()[slot] = val;
+            return;
+        }
+
+        if(node -> count == NODE_KEYS){
+            node_type * upper = split_node(node, prev);
+            if(slot > node -> count){
+                slot -= node -> count;
+                node = upper;
+            }
+        }
+
+        insert_into_node(node, slot, key, val);
+        skiplist_size += 1;
+    }
+
+    // Remove a key.
+    void remove(const KEY& key) {
+        node_type * node = find_node(key);
+        size_t slot = node == start ? 0 : rank_in_node(node, key, false);
+
+        // key is not present in the skiplist
+        if(node == start or slot == node -> count or !equal(node -> keys()[slot], key)){
+            throw std::invalid_argument("Key not found in skiplist. Cannot delete.");
+        }
+
+        // Removing the first key leaves the towers in order, since the node's keys all stay between its neighbours'.
+        for(size_t i = slot + 1; i < node -> count; ++i){
+            node -> keys()[i - 1] = std::move(node -> keys()[i]);
+            node -> vals()[i - 1] = std::move(node -> vals()[i]);
+        }
+        node -> count -= 1;
+        skiplist_size -= 1;
+
+        // An emptied node is freed, before anything compares against its slot. key is still its first key,
+        // since nothing was shifted into it, so it finds the node's predecessors.
+        if(node -> count == 0){
+            node_type * prev[skiplist_max_height + 1];
+            find_predecessors(key, prev, true);
+            unlink_node(node, prev);
+            return;
+        }
+
+        clear_slots(node, node -> count, node -> count + 1);
+        if(node -> count < NODE_KEYS / 4){
+            rebalance(node);
+        }
+    }
+
+    size_t size() {
+        return skiplist_size;
+    }
+
+    // Number of nodes holding the entries.
+    size_t get_num_nodes() {
+        return num_nodes;
+    }
+
+};
+
+#endif